@@ -0,0 +1,391 @@
+/*
+ * gpioman-bench: find out how many lines, at what freq, the machine can
+ * drive with the gpio manager before accuracy collapses.
+ *
+ * For 1, 2, 4, ... lines (up to all the output lines there are), freq is
+ * swept upwards from -f to -F in steps of a factor of -s. At each step, the
+ * lines are all configured (and restarted together) in one go through
+ * /dev/gpioman-control, left to run for -t ms with the module's callback
+ * benchmarking on (see <debugfs>/gpioman/bench), and then the edge rate each
+ * line achieved, its callback latency and overruns, and the CPU time used
+ * are collected. A step passes if every line got within -e ppm of the edge
+ * rate requested without any overruns; the sweep for a number of lines ends
+ * at the first step that does not.
+ *
+ * The report goes to stdout as JSON, one object per line: one per step, then
+ * one per number of lines with the highest freq that passed (0 if none did).
+ *
+ *   # gpioman-bench -f 1000 -F 200000 -t 2000 > report.json
+ *
+ * NOTE: all the lines are taken over (and stopped when done); debugfs must be
+ * mounted. Build with 'make bench'.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+#include "gpioman_uapi.h"
+
+#define SYSFS_DIR   "/sys/kernel/gpioman-driver"
+#define DEBUGFS_DIR "/sys/kernel/debug/gpioman"
+#define CONTROL_DEV "/dev/gpioman-control"
+#define WARMUP_MS   100
+
+struct bench_line {
+    char name[256];
+    unsigned int id;
+    unsigned long overruns;   /* at the start of the step */
+};
+
+/* results of a step, over all the lines in it */
+struct bench_step {
+    unsigned long long requested;     /* edges/s, per line */
+    unsigned long long achieved_min;  /* edges/s */
+    unsigned long long achieved_max;
+    unsigned long long error_ppm;     /* of the line furthest off */
+    unsigned long long cost_ns;       /* mean per callback, worst line */
+    unsigned long long p99_ns;        /* lateness, worst line */
+    unsigned long overruns;
+    double cpu;                       /* fraction of all CPUs busy */
+};
+
+static struct {
+    unsigned long fmin, fmax, factor;
+    unsigned int on, off;
+    unsigned int ms;
+    unsigned int max_lines;
+    unsigned long tolerance_ppm;
+    int backend;      /* -1 to leave as is */
+    int edge_sched;   /* -1 to leave as is */
+} opts = {
+    .fmin = 100, .fmax = 100000, .factor = 2,
+    .on = 1, .off = 1,
+    .ms = 1000,
+    .tolerance_ppm = 10000,
+    .backend = -1, .edge_sched = -1,
+};
+
+static int read_file(const char *path, char *buf, size_t size){
+    ssize_t n;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0) return -errno;
+    n = read(fd, buf, size - 1);
+    close(fd);
+
+    if (n < 0) return -errno;
+    buf[n] = '\0';
+    return 0;
+}
+
+static int write_file(const char *path, const char *s){
+    ssize_t n;
+    int fd;
+
+    if ((fd = open(path, O_WRONLY)) < 0) return -errno;
+    n = write(fd, s, strlen(s));
+    close(fd);
+
+    return n < 0 ? -errno : 0;
+}
+
+static int line_attr_read(const struct bench_line *l, const char *attr, char *buf, size_t size){
+    char path[512];
+
+    snprintf(path, sizeof(path), SYSFS_DIR "/%s/%s", l->name, attr);
+    return read_file(path, buf, size);
+}
+
+static int line_attr_write(const struct bench_line *l, const char *attr, const char *s){
+    char path[512];
+
+    snprintf(path, sizeof(path), SYSFS_DIR "/%s/%s", l->name, attr);
+    return write_file(path, s);
+}
+
+static int line_debugfs_read(const struct bench_line *l, const char *file, char *buf, size_t size){
+    char path[512];
+
+    snprintf(path, sizeof(path), DEBUGFS_DIR "/%s/%s", l->name, file);
+    return read_file(path, buf, size);
+}
+
+/* the value on the line starting with 'key' in buf; 0 if there is none */
+static unsigned long long field(const char *buf, const char *key){
+    const char *p = buf;
+    size_t len = strlen(key);
+
+    while (p && *p){
+        if (!strncmp(p, key, len)){
+            p += len;
+            while (*p && (*p < '0' || *p > '9')) p++;  /* e.g. "< " */
+            return strtoull(p, NULL, 10);
+        }
+        if ((p = strchr(p, '\n'))) p++;
+    }
+
+    return 0;
+}
+
+/*
+ * Collect the output lines: those that take mode 0 (inputs and parallel
+ * ports do not), sorted by id. */
+static int find_lines(struct bench_line **lines){
+    struct bench_line *v = NULL, *tmp, l;
+    struct dirent *de;
+    char buf[64];
+    int n = 0, i, j;
+    DIR *dir;
+
+    if (!(dir = opendir(SYSFS_DIR))){
+        perror(SYSFS_DIR);
+        return -1;
+    }
+
+    while ((de = readdir(dir))){
+        if (de->d_name[0] == '.') continue;
+        if (strlen(de->d_name) >= sizeof(l.name)) continue;
+
+        memset(&l, 0, sizeof(l));
+        strcpy(l.name, de->d_name);
+        if (line_attr_read(&l, "id", buf, sizeof(buf))) continue;  /* not a line */
+        l.id = strtoul(buf, NULL, 10);
+
+        if (line_attr_write(&l, "mode", "0")){
+            fprintf(stderr, "skipping %s: not a pulse generator\n", l.name);
+            continue;
+        }
+
+        if (!(tmp = realloc(v, (n + 1) * sizeof(*v)))){
+            free(v); closedir(dir);
+            return -1;
+        }
+        v = tmp;
+        v[n++] = l;
+    }
+    closedir(dir);
+
+    for (i = 1; i < n; i++){
+        l = v[i];
+        for (j = i; j > 0 && v[j - 1].id > l.id; j--) v[j] = v[j - 1];
+        v[j] = l;
+    }
+
+    *lines = v;
+    return n;
+}
+
+/* the first n lines at freq, the other ones stopped; all restarted together */
+static int configure(int fd, const struct bench_line *lines, int nlines, int n, unsigned long freq){
+    struct gpioman_line_config cfg[GPIOMAN_CONFIG_MAX];
+    struct gpioman_config req = {
+        .entries = (uintptr_t)cfg,
+        .count = nlines,
+        .flags = GPIOMAN_CONFIG_SYNC,
+    };
+    int i;
+
+    for (i = 0; i < nlines; i++){
+        cfg[i] = (struct gpioman_line_config){
+            .id = lines[i].id,
+            .freq = i < n ? freq : 0,
+            .on_cycles = opts.on,
+            .off_cycles = opts.off,
+            .status = i < n,
+            .phase = 0,
+        };
+    }
+
+    if (ioctl(fd, GPIOMAN_IOC_CONFIG, &req) < 0){
+        perror("GPIOMAN_IOC_CONFIG");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* busy and total jiffies over all CPUs, as per /proc/stat */
+static int cpu_times(unsigned long long *busy, unsigned long long *total){
+    unsigned long long v[8] = {0};
+    char buf[512];
+    int i;
+
+    if (read_file("/proc/stat", buf, sizeof(buf))) return -1;
+    if (sscanf(buf, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+                &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) < 4)
+        return -1;
+
+    for (*total = 0, i = 0; i < 8; i++) *total += v[i];
+    *busy = *total - v[3] - v[4];  /* less idle and iowait */
+    return 0;
+}
+
+static int run_step(int fd, struct bench_line *lines, int nlines, int n,
+        unsigned long freq, struct bench_step *st)
+{
+    unsigned long long busy0, total0, busy1, total1, achieved, requested, err;
+    char buf[4096];
+    int i;
+
+    memset(st, 0, sizeof(*st));
+    st->achieved_min = ~0ULL;
+
+    if (configure(fd, lines, nlines, n, freq)) return -1;
+    usleep(WARMUP_MS * 1000);
+
+    for (i = 0; i < n; i++){
+        char path[512];
+
+        snprintf(path, sizeof(path), DEBUGFS_DIR "/%s/reset", lines[i].name);
+        if (write_file(path, "1")){
+            perror(path);
+            return -1;
+        }
+        if (line_attr_read(&lines[i], "overruns", buf, sizeof(buf))) return -1;
+        lines[i].overruns = strtoul(buf, NULL, 10);
+    }
+
+    if (cpu_times(&busy0, &total0)) return -1;
+    usleep(opts.ms * 1000);
+    if (cpu_times(&busy1, &total1)) return -1;
+
+    st->cpu = total1 > total0 ? (double)(busy1 - busy0) / (total1 - total0) : 0;
+
+    for (i = 0; i < n; i++){
+        if (line_debugfs_read(&lines[i], "bench", buf, sizeof(buf))) return -1;
+        achieved = field(buf, "achieved:");
+        requested = field(buf, "requested:");
+        if (field(buf, "cost mean:") > st->cost_ns) st->cost_ns = field(buf, "cost mean:");
+
+        if (achieved < st->achieved_min) st->achieved_min = achieved;
+        if (achieved > st->achieved_max) st->achieved_max = achieved;
+        st->requested = requested;
+
+        err = achieved > requested ? achieved - requested : requested - achieved;
+        err = requested ? err * 1000000 / requested : 1000000;
+        if (err > st->error_ppm) st->error_ppm = err;
+
+        if (line_debugfs_read(&lines[i], "latency", buf, sizeof(buf))) return -1;
+        if (field(buf, "p99:") > st->p99_ns) st->p99_ns = field(buf, "p99:");
+
+        if (line_attr_read(&lines[i], "overruns", buf, sizeof(buf))) return -1;
+        st->overruns += strtoul(buf, NULL, 10) - lines[i].overruns;
+    }
+
+    return 0;
+}
+
+static void usage(const char *prog){
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -f HZ    lowest freq (default %lu)\n"
+        "  -F HZ    highest freq (default %lu)\n"
+        "  -s N     freq step factor (default %lu)\n"
+        "  -c N     on_cycles (default %u)\n"
+        "  -C N     off_cycles (default %u)\n"
+        "  -t MS    time per step (default %u)\n"
+        "  -n N     at most N lines (default: all)\n"
+        "  -e PPM   edge rate tolerance (default %lu)\n"
+        "  -b N     set the timer backend of all the lines first\n"
+        "  -E 0|1   set edge_sched of all the lines first\n",
+        prog, opts.fmin, opts.fmax, opts.factor, opts.on, opts.off, opts.ms,
+        opts.tolerance_ppm);
+}
+
+int main(int argc, char **argv){
+    struct bench_line *lines = NULL;
+    struct bench_step st;
+    unsigned long freq, best;
+    int fd, c, nlines, limit, n, i, rc = 1;
+    char buf[16];
+
+    while ((c = getopt(argc, argv, "f:F:s:c:C:t:n:e:b:E:h")) != -1){
+        switch (c){
+        case 'f': opts.fmin = strtoul(optarg, NULL, 10); break;
+        case 'F': opts.fmax = strtoul(optarg, NULL, 10); break;
+        case 's': opts.factor = strtoul(optarg, NULL, 10); break;
+        case 'c': opts.on = strtoul(optarg, NULL, 10); break;
+        case 'C': opts.off = strtoul(optarg, NULL, 10); break;
+        case 't': opts.ms = strtoul(optarg, NULL, 10); break;
+        case 'n': opts.max_lines = strtoul(optarg, NULL, 10); break;
+        case 'e': opts.tolerance_ppm = strtoul(optarg, NULL, 10); break;
+        case 'b': opts.backend = atoi(optarg); break;
+        case 'E': opts.edge_sched = atoi(optarg); break;
+        default: usage(argv[0]); return c == 'h' ? 0 : 1;
+        }
+    }
+
+    if (!opts.fmin || opts.fmin > opts.fmax || opts.factor < 2 || !opts.on || !opts.off){
+        usage(argv[0]);
+        return 1;
+    }
+
+    if ((nlines = find_lines(&lines)) <= 0){
+        fprintf(stderr, "no lines to benchmark\n");
+        return 1;
+    }
+    if (nlines > GPIOMAN_CONFIG_MAX) nlines = GPIOMAN_CONFIG_MAX;
+
+    if ((fd = open(CONTROL_DEV, O_RDWR)) < 0){
+        perror(CONTROL_DEV);
+        goto out_free;
+    }
+
+    if (write_file(DEBUGFS_DIR "/bench", "1")){
+        perror(DEBUGFS_DIR "/bench");
+        goto out_close;
+    }
+
+    for (i = 0; i < nlines; i++){
+        snprintf(buf, sizeof(buf), "%d", opts.backend);
+        if (opts.backend >= 0 && line_attr_write(&lines[i], "backend", buf))
+            fprintf(stderr, "%s: cannot set backend %d\n", lines[i].name, opts.backend);
+
+        snprintf(buf, sizeof(buf), "%d", opts.edge_sched);
+        if (opts.edge_sched >= 0 && line_attr_write(&lines[i], "edge_sched", buf))
+            fprintf(stderr, "%s: cannot set edge_sched\n", lines[i].name);
+    }
+
+    limit = opts.max_lines && (int)opts.max_lines < nlines ? (int)opts.max_lines : nlines;
+
+    /* 1, 2, 4, ... lines, and then all of them */
+    for (n = 1; n <= limit; n = n == limit ? n + 1 : (n * 2 < limit ? n * 2 : limit)){
+        best = 0;
+        for (freq = opts.fmin; freq <= opts.fmax; freq *= opts.factor){
+            if (run_step(fd, lines, nlines, n, freq, &st)) goto out_stop;
+
+            printf("{\"lines\": %d, \"freq\": %lu, \"requested_eps\": %llu, "
+                    "\"achieved_eps_min\": %llu, \"achieved_eps_max\": %llu, "
+                    "\"error_ppm\": %llu, \"callback_ns\": %llu, \"p99_late_ns\": %llu, "
+                    "\"overruns\": %lu, \"cpu\": %.4f, \"ok\": %s}\n",
+                    n, freq, st.requested, st.achieved_min, st.achieved_max,
+                    st.error_ppm, st.cost_ns, st.p99_ns, st.overruns, st.cpu,
+                    st.error_ppm <= opts.tolerance_ppm && !st.overruns ? "true" : "false");
+            fflush(stdout);
+
+            if (st.error_ppm > opts.tolerance_ppm || st.overruns) break;
+            best = freq;
+        }
+
+        printf("{\"lines\": %d, \"max_freq\": %lu}\n", n, best);
+        fflush(stdout);
+    }
+
+    rc = 0;
+
+out_stop:
+    configure(fd, lines, nlines, 0, 0);
+    write_file(DEBUGFS_DIR "/bench", "0");
+out_close:
+    close(fd);
+out_free:
+    free(lines);
+    return rc;
+}
@@ -0,0 +1,121 @@
+#!/bin/sh
+# Smoke test of a running module: drive one line of a gpio-mockup chip with
+# each of the given timer backends at each of the given frequencies, and
+# check the achieved edge rate and the timer lateness (jitter) against limits.
+# Run as root on the target, from the directory gpioman.ko was built in. The
+# kernel needs gpio-mockup, debugfs and DT overlays (configfs); dtc must be
+# installed. Exits non-zero if any check fails. See the README.
+#
+# Environment (defaults in brackets):
+#   BACKENDS timer backends of the line to run with [0 1]
+#   FREQS    time slots per second to run at [1000 10000]; the lowres
+#            backend (0) is clamped to HZ
+#   SECS     how long to measure each run for [5]
+#   MAX_PPM  largest error of the edge rate, in ppm [10000]
+#   MAX_P99  largest p99 lateness, in ns [131072]
+set -eu
+
+BACKENDS=${BACKENDS:-0 1}
+FREQS=${FREQS:-1000 10000}
+SECS=${SECS:-5}
+MAX_PPM=${MAX_PPM:-10000}
+MAX_P99=${MAX_P99:-131072}
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+OVERLAY=/sys/kernel/config/device-tree/overlays/gpioman-smoke
+LINE=/sys/kernel/gpioman-driver/gpioman_smoke
+DEBUGFS=/sys/kernel/debug/gpioman
+LOADED=0
+FAILED=0
+
+fail(){ echo "FAIL: $*" >&2; exit 1; }
+
+# report a failed check of the run under way and go on with the next one
+check_failed(){ echo "FAIL: backend $1 at $2 Hz: $3" >&2; FAILED=1; }
+
+cleanup(){
+    [ -w "$LINE/status" ] && echo 0 > "$LINE/status"
+    [ -w "$DEBUGFS/bench" ] && echo 0 > "$DEBUGFS/bench"
+    [ -d "$OVERLAY" ] && rmdir "$OVERLAY"
+    [ "$LOADED" = 1 ] && rmmod gpioman
+    rm -f /tmp/gpioman-mockup.dtbo
+}
+trap cleanup EXIT
+
+mountpoint -q /sys/kernel/debug || mount -t debugfs none /sys/kernel/debug
+modprobe gpio-mockup
+if ! [ -d /sys/module/gpioman ]; then
+    insmod "$HERE/gpioman.ko"
+    LOADED=1
+fi
+
+dtc -@ -q -I dts -O dtb -o /tmp/gpioman-mockup.dtbo "$HERE/gpioman-mockup.dto"
+mkdir "$OVERLAY"
+cat /tmp/gpioman-mockup.dtbo > "$OVERLAY/dtbo"
+
+# the device is probed asynchronously
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    [ -d "$LINE" ] && break
+    sleep 1
+done
+[ -d "$LINE" ] || fail "gpioman_smoke was not bound; see dmesg"
+
+# one run: the line at $2 time slots per second with backend $1
+run(){
+    echo "== backend $1, $2 Hz"
+    echo 0 > "$LINE/status"
+    echo "$1" > "$LINE/backend"
+    echo "$2 1 1 1" > "$LINE/config"
+    echo 1 > "$DEBUGFS/gpioman_smoke/reset"
+    sleep "$SECS"
+
+    bench=$(cat "$DEBUGFS/gpioman_smoke/bench")
+    latency=$(cat "$DEBUGFS/gpioman_smoke/latency")
+    echo "$bench"
+    echo "$latency" | grep '^p' || true
+
+    # the line really does toggle
+    if [ -n "$chip" ] && [ -r "$val" ]; then
+        seen= i=0
+        while [ $i -lt 200 ]; do seen="$seen$(cat "$val")"; i=$((i + 1)); done
+        case "$seen" in *0*) ;; *) check_failed "$1" "$2" "line never LOW" ;; esac
+        case "$seen" in *1*) ;; *) check_failed "$1" "$2" "line never HIGH" ;; esac
+    fi
+
+    achieved=$(echo "$bench" | sed -n 's/^achieved: \([0-9]*\).*/\1/p')
+    requested=$(echo "$bench" | sed -n 's/^requested: \([0-9]*\).*/\1/p')
+    p99=$(echo "$latency" | sed -n 's/^p99: [<>=]* \([0-9]*\).*/\1/p')
+    if ! { [ -n "$achieved" ] && [ -n "$requested" ] && [ "$requested" -gt 0 ]; }; then
+        check_failed "$1" "$2" "no edge rate in bench"
+        return
+    fi
+
+    err=$(( (achieved - requested) * 1000000 / requested ))
+    [ "$err" -lt 0 ] && err=$(( -err ))
+
+    echo "error: $err ppm (max $MAX_PPM), p99 bucket: $p99 ns (max $MAX_P99)"
+    [ "$err" -le "$MAX_PPM" ] || check_failed "$1" "$2" "edge rate off by $err ppm"
+    if [ -z "$p99" ]; then
+        check_failed "$1" "$2" "no callbacks in latency"
+    elif ! echo "$latency" | grep -q '^p99: <'; then
+        check_failed "$1" "$2" "p99 lateness beyond the histogram"
+    elif [ "$p99" -gt "$MAX_P99" ]; then
+        check_failed "$1" "$2" "p99 lateness $p99 ns"
+    fi
+}
+
+chip=$(sed -n 's/^\(gpiochip[0-9]*\):.*gpioman-mock.*/\1/p' /sys/kernel/debug/gpio | head -n1)
+val=/sys/kernel/debug/gpio-mockup/$chip/0
+if [ -z "$chip" ] || ! [ -r "$val" ]; then
+    echo "NOTE: $val not found; not checking the line level"
+fi
+
+echo 1 > "$DEBUGFS/bench"
+for backend in $BACKENDS; do
+    for freq in $FREQS; do
+        run "$backend" "$freq"
+    done
+done
+
+[ "$FAILED" = 0 ] || fail "see above"
+echo PASS
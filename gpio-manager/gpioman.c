@@ -3,15 +3,51 @@
 #include <linux/of.h>               /* of_device_id */
 #include <linux/platform_device.h>  /* platform device and driver */
 #include <linux/gpio/consumer.h>    /* gpiod_get etc */
+#include <linux/gpio/driver.h>      /* gpiod_to_chip; see line_io_init() */
 #include <linux/string.h>
 #include <linux/list.h>
 #include <linux/slab.h>
+#include <linux/math64.h>           /* div_u64_rem etc */
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/bitmap.h>
+#include <linux/atomic.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/jump_label.h>       /* static keys */
+#include <linux/miscdevice.h>
+#include <linux/cdev.h>
+#include <linux/device.h>           /* class_create, device_create */
+#include <linux/idr.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/irq_work.h>
+#include <linux/io.h>
+#include <linux/of_address.h>       /* of_iomap, of_get_address */
+#include <linux/of_gpio.h>          /* of_get_named_gpio_flags; see line_io_init() */
+#include <linux/clk.h>
+#include <linux/dmaengine.h>
+#include <linux/dma-mapping.h>
+#include <linux/pinctrl/consumer.h>
+#include <linux/gcd.h>
+#include <linux/pwm.h>
+#include <linux/kthread.h>
+#include <linux/llist.h>
+#include <linux/xarray.h>
+#include <linux/workqueue.h>
+#include <linux/interrupt.h>
+#include <linux/uaccess.h>
+#include <linux/int_sqrt.h>
 
-#ifdef USE_HR_TIMERS
 #include <linux/hrtimer.h>
-#else
 #include <linux/timer.h>
-#endif
+
+#define CREATE_TRACE_POINTS
+#include "gpioman_trace.h"
+#include "gpioman_uapi.h"
 
 /*
  * NOTE: these are *logic* values that signify a logic level assertion
@@ -25,6 +61,44 @@
 #define US_PER_SEC 1000000   /* 10e6 */
 #define KERNEL_HERTZ HZ      /* see /usr/include/asm/param.h */
 
+/*
+ * Timer backends; each line can use a different one (see the 'backend'
+ * sysfs attribute and the vcstech,timer-backend DT property). Slow lines
+ * can use the cheap jiffy-based timers, which coalesce with the tick, while
+ * fast lines get the precise hrtimer path. */
+enum timer_backend {
+    BACKEND_LOWRES = 0,        /* timer_list */
+    BACKEND_HRTIMER = 1,       /* hrtimer; callback runs in softirq context */
+    BACKEND_HRTIMER_HARD = 2,  /* hrtimer; callback runs in hard irq context,
+                                  even on PREEMPT_RT */
+    BACKEND_DMA = 3,           /* no timer: played by the hardware; see
+                                  struct line_dma */
+    NUM_BACKENDS
+};
+
+/* as used in the DT */
+static const char *const backend_names[NUM_BACKENDS] = {
+    [BACKEND_LOWRES]       = "lowres",
+    [BACKEND_HRTIMER]      = "hrtimer",
+    [BACKEND_HRTIMER_HARD] = "hrtimer-hard",
+    [BACKEND_DMA]          = "dma",
+};
+
+/*
+ * USE_HR_TIMERS only picks the default; see the Makefile. NOTE: hard irq
+ * expiry is opt-in (sysfs or DT), since on PREEMPT_RT it takes the gpio
+ * writes, tracing and latency accounting into hard irq context. */
+#ifdef USE_HR_TIMERS
+#define DEFAULT_BACKEND BACKEND_HRTIMER
+#else
+#define DEFAULT_BACKEND BACKEND_LOWRES
+#endif
+
+/*
+ * Resolution of the timer backend: time slot durations and timer expiries
+ * are nanoseconds with high-res timers and jiffies with low-res timers. */
+#define backend_units_per_sec(b) ((b) == BACKEND_LOWRES ? KERNEL_HERTZ : NSEC_PER_SEC)
+
 #define message(fmt, ...) pr_info(KBUILD_MODNAME ": " fmt "\n", ##__VA_ARGS__)
 #define match(a, b) strcmp(a, b) == 0
 #define UNUSED(x) (void)x
@@ -40,64 +114,502 @@
 #define DRIVER_SYSFS_DIRNAME "gpioman-driver"
 
 /*
- * Per gpio-pin state. Each gpio is associated with a virtual
- * (since for our purposes there is no fixed physical device)
- * platform device; therefore this is also per-device state. */
-struct gpio_line_state {
-    struct list_head list;
-    struct kobject kobj;
-    const char *devname;  /* property read from the device tree */
+ * Time slot duration for a given freq, in timer units (units_per_sec).
+ * See slots_to_interval(). */
+struct slot_timebase {
+    u32 units_per_sec;     /* resolution of the timer backend */
+    u32 freq;
+    u32 pulse_period;      /* 1/freq, rounded down */
+    u32 pulse_period_rem;  /* remainder of the above division */
+    u32 phase_acc;         /* fractional phase accumulator */
+};
 
-#ifdef USE_HR_TIMERS
-    struct hrtimer timer;
-#else
-    struct timer_list timer;
-#endif
+/*
+ * Timer callback latency: how late the callback ran relative to the expiry
+ * it was scheduled for. Bucket 0 counts callbacks that were on time; bucket
+ * i > 0 counts latencies in [2^(i-1), 2^i) ns (the last one is open-ended).
+ * Exposed in debugfs; see latency_record(). */
+#define LATENCY_BUCKETS 32
+
+struct latency_stats {
+    u64 hist[LATENCY_BUCKETS];
+    u64 count;
+    u64 sum;
+    u64 min;
+    u64 max;
+
+    /* only while benchmarking; see bench_record() */
+    u64 bench_count;     /* callbacks timed */
+    u64 bench_first;     /* time of the first and last of them, in ns */
+    u64 bench_last;
+    u64 cost_sum;        /* time spent in them, in ns */
+    u64 cost_max;
+    u64 edges;           /* level changes they made */
+
+    atomic_t reset_req;        /* bumped by debugfs writers to request a reset */
+    unsigned int reset_seen;   /* last reset_req carried out by the callback */
+};
+
+struct line_group;
+
+/*
+ * Common start time of the lines (re)started together through the 'start'
+ * driver attribute, for either kind of timer; see start_all_lines(). */
+struct line_epoch {
+    ktime_t hr;
+    unsigned long jiffies;
+};
+
+/* how far ahead of the 'start' write the epoch is put, such that all the
+ * lines can be armed before it comes */
+#define START_LEAD_US 2000
+
+/* upper bound of 'slack_us' */
+#define SLACK_MAX_US USEC_PER_SEC
+
+/* latency compensation: the most a timer is ever armed early by, and the
+ * weight of each new measurement, 1/2^COMP_GAIN_SHIFT */
+#define COMP_MAX_NS 100000
+#define COMP_GAIN_SHIFT 3
+
+/* a timer of either kind; 'backend' says which member is in use */
+struct line_timer {
+    int backend;
+    int cpu;      /* CPU the timer is pinned to; -1 if not pinned */
+    u64 slack;    /* ns the hrtimer may fire late by, to coalesce wakeups */
+
+    /* hrtimers: armed early by comp_ns[comp_idx], the learned latency of
+     * the edge to come (per level); see hr_comp_update() */
+    bool comp;
+    unsigned int comp_idx;
+    u64 comp_ns[2];
+    union {
+        struct hrtimer hr;
+        struct timer_list lr;
+    };
+};
+
+/*
+ * DMA waveform engine for the Raspberry Pi SoCs (bcm2835/bcm2711), taking
+ * the CPU out of the loop altogether (backend=3). The PWM block is put in
+ * serializer mode, where it shifts the bits of the words in its FIFO out onto
+ * the pin, one per PWM clock cycle, and a cyclic DMA transfer paced by the
+ * PWM DREQ keeps the FIFO topped up from a buffer holding the waveform
+ * rendered one bit per time slot. The PWM clock is set to freq -- or to a
+ * multiple of it, with each time slot stretched over that many bits, where
+ * the clock cannot run at freq itself; see line_dma_set_rate().
+ * NOTE: the line must hence be on a pin the PWM channel can be muxed to (e.g.
+ * GPIO 12/18 for channel 0 and 13/19 for channel 1 on the 40-pin header), and
+ * the PWM block must not be used by anything else. See line_dma_init(). */
+#define PWM_CTL   0x00
+#define PWM_DMAC  0x08
+#define PWM_RNG1  0x10
+#define PWM_FIF1  0x18
+#define PWM_RNG2  0x20
+
+/* CTL bits of channel 0; those of channel 1 are shifted by 8. CLRF is shared */
+#define PWM_CTL_PWEN   BIT(0)
+#define PWM_CTL_MODE   BIT(1)   /* serializer */
+#define PWM_CTL_SBIT   BIT(3)   /* output level while the FIFO is empty */
+#define PWM_CTL_POLA   BIT(4)
+#define PWM_CTL_USEF   BIT(5)
+#define PWM_CTL_CLRF   BIT(6)
+
+#define PWM_DMAC_ENAB       BIT(31)
+#define PWM_DMAC_THRESHOLDS ((7 << 8) | 3)  /* PANIC, DREQ */
+
+#define DMA_MAX_FREQ    25000000  /* serializer bits (time slots) per second */
+#define DMA_BUF_WORDS   16384     /* 64 KiB: 512K serializer bits */
+#define DMA_MAX_STRETCH 32        /* serializer bits per time slot */
+
+struct line_dma {
+    void __iomem *pwm;            /* PWM registers, as seen by the CPU */
+    dma_addr_t fifo;              /* PWM FIFO, as seen by the DMA controller */
+    unsigned int channel;         /* PWM channel the pin is muxed to */
+    struct clk *clk;              /* PWM clock */
+    struct dma_chan *chan;
+    struct pinctrl *pinctrl;
+    struct pinctrl_state *pins;   /* the pin muxed to the PWM channel */
+    u32 *buf;
+    dma_addr_t buf_dma;
+    unsigned int stretch;         /* serializer bits per time slot */
+    bool running;
+};
+
+/*
+ * How the timer callbacks write the line, picked at probe time; see
+ * line_io_init(). gpiod_set_value() validates the descriptor, translates
+ * active-low and checks for sleeping on every call before making an indirect
+ * call into the gpio chip driver, which at high frequencies comes to most of
+ * the cost of the callback. The fast paths do all of that once, up front.
+ * NOTE: they write the value straight to the pin, so they are only for plain
+ * push-pull lines; see line_io_init(). */
+enum line_io_kind {
+    IO_GPIOD = 0,  /* gpiod_set_value(); for all lines the others are not for */
+    IO_CHIP,       /* bcm2835/bcm2711: the chip's set() op, called directly */
+    IO_MMIO,       /* bcm2835/bcm2711: straight to the GPSET/GPCLR registers */
+    IO_WORKER,     /* chips that can sleep: deferred to io_worker */
+    IO_PORT,       /* parallel port: all the lines in one gpiod_set_array_value() */
+};
+
+#define BCM2835_GPSET0 0x1c
+#define BCM2835_GPCLR0 0x28
+
+/*
+ * The registers of a gpio controller, mapped once for all of its IO_MMIO
+ * lines rather than once per line: the lines of a bank then have the same
+ * set_reg/clr_reg, which line_group_update_io() relies on to tell them
+ * apart from those of other banks. See gpio_regs_get(). */
+struct gpio_regs {
+    struct list_head list;    /* in 'gpio_regs_maps' */
+    struct device_node *np;   /* of the controller */
+    void __iomem *base;
+    unsigned int users;       /* under gpio_regs_lock */
+};
+
+struct line_io {
+    int kind;
+    bool active_low;
+
+    struct gpio_chip *chip;   /* IO_CHIP and IO_MMIO */
+    unsigned int offset;      /* of the line within the chip */
+
+    struct gpio_regs *regs;   /* IO_MMIO: gpio registers */
+    void __iomem *set_reg;    /* GPSETn and GPCLRn of the bank of the line */
+    void __iomem *clr_reg;
+    u32 mask;                 /* bit of the line within the bank */
+};
+
+/*
+ * Pulse train parameters as requested via sysfs. Writers never modify the
+ * settings the timer callback runs off of (gls->on_cycles etc) while it may
+ * be running: they publish new parameters here instead, under the seqcount,
+ * and the callback picks them up -- without ever taking a lock -- at the
+ * next time slot or, if 'at_boundary' (see the 'config' attribute), at the
+ * next composite-period boundary, i.e. when the line goes back to the
+ * on_cycles state, such that the waveform switches over without any glitch.
+ * Sysfs reads are served from here, locklessly as well.
+ * See line_params_sync(). */
+struct line_params {
+    u32 freq;
+    int on_cycles;
+    int off_cycles;
+    bool at_boundary;
+    u32 ramp_ms;        /* ramp to the above over this long; see struct line_ramp */
+    int curve;          /* enum ramp_curve */
+    unsigned int gen;   /* bumped on every update */
+};
+
+/*
+ * Fades: parameters published with a ramp_ms are not put into effect in one
+ * go but ramped to from the settings in effect, by the timer callback, at
+ * each composite-period boundary over ramp_ms; see line_ramp_step(). The
+ * linear curve interpolates freq, on_cycles and off_cycles alike. The gamma
+ * one makes the (square root of the) duty cycle ramp linearly instead, which
+ * is how the perceived brightness of an LED goes. */
+enum ramp_curve {
+    RAMP_LINEAR = 0,
+    RAMP_GAMMA = 1,
+    NUM_RAMP_CURVES
+};
+
+#define RAMP_MAX_MS (3600 * 1000)
+
+/* owned by the timer callback */
+struct line_ramp {
+    bool active;
+    int curve;
+    u64 start_ns;
+    u64 duration_ns;
+    u32 freq0, freq1;
+    int on0, on1;
+    int off0, off1;
+    u32 duty0, duty1;   /* RAMP_GAMMA: square roots of the duty cycles, Q16 */
+};
+
+/*
+ * What the line is driven with; see the 'mode' attribute. */
+enum line_mode {
+    MODE_PULSE = 0,         /* on_cycles HIGH, off_cycles LOW, repeat */
+    MODE_PATTERN_ONCE = 1,  /* play the pattern once, then LOW */
+    MODE_PATTERN_LOOP = 2,  /* play the pattern over and over */
+    MODE_STREAM = 3,        /* play entries from the chardev ring as they come */
+    MODE_PDM = 4,           /* pulse-density modulation, as per 'brightness' */
+    NUM_MODES
+};
+
+/* brightness full scale for MODE_PDM; see pdm_step() */
+#define PDM_MAX 65535
+
+/*
+ * Pattern playback: the line is driven through a list of (level, duration)
+ * entries uploaded via the 'pattern' binary attribute. Each entry is a u32:
+ * bit 31 is the level, bits 30..0 the duration in time slots (1/freq). Like
+ * with edge-driven scheduling, only the transitions cost a timer event. */
+#define PATTERN_MAX_ENTRIES 4096
+#define PATTERN_LEVEL(e)    ((e) >> 31)
+#define PATTERN_SLOTS(e)    ((e) & 0x7fffffff)
+
+/* NOTE: a parallel port has no use for durations; see entry_slots() */
+#define PORT_MAX_LINES 32
+
+struct line_pattern {
+    unsigned int len;     /* number of entries */
+    unsigned int nsteps;  /* number of entries with a nonzero duration */
+    u64 total_slots;      /* duration of the whole pattern */
+    u32 entries[PATTERN_MAX_ENTRIES];
+};
+
+/*
+ * Input capture (vcstech,input): the edges of the line are timestamped in
+ * its hard irq handler and put in a single-producer, single-consumer ring
+ * that read() on the character device drains in bulk. Events for which there
+ * is no room are dropped and counted in 'overruns'. The last period and
+ * HIGH time measured are kept for the measured_freq and measured_duty
+ * attributes. See capture_irq(). */
+#define CAPTURE_RING_EVENTS 8192  /* power of 2 */
+
+struct line_capture {
+    int irq;
+    u32 head;        /* written by the irq handler */
+    u32 tail;        /* written by read(), under read_lock */
+    u32 batch;       /* readers are woken up once this many events are pending */
+    struct mutex read_lock;
 
-    struct gpio_desc *gpio_descriptor;
+    /* written by the irq handler only */
+    u64 last_rise;
+    u64 last_fall;
+    u64 period_ns;   /* between the last two rising edges */
+    u64 high_ns;     /* between the last rising edge and the falling one after it */
 
-    /* syfs-controlled */
-    int pulse_period;
+    struct gpioman_event events[CAPTURE_RING_EVENTS];
+};
+
+/*
+ * Per gpio-pin state. Each gpio is associated with a virtual
+ * (since for our purposes there is no fixed physical device)
+ * platform device; therefore this is also per-device state.
+ *
+ * NOTE: the state the timer callbacks go through on every tick comes first,
+ * in the first cache line of the object (instances come from gls_cache,
+ * which aligns them to cache lines), followed by the rest of what they (and
+ * the capture irq handler) touch; the configuration and bookkeeping only
+ * looked at from process context is kept out of the way, after 'kobj'.
+ * Tracepoints, when enabled, are the exception: they read 'devname'. */
+struct gpio_line_state {
+    /* syfs-controlled; NOTE: the parameters in effect. Owned by the timer
+     * callback while the pulse train is running */
+    struct gpio_desc *gpio_descriptor;  /* the first line of a port */
+    struct slot_timebase tb;
 
     int on_cycles;
     int off_cycles;
     int counter;
+    int pin_logic_level;  /* parallel port: the word, bit i the i-th line */
 
     int pin_ctl_enabled;
-    int pin_logic_level;
+    int mode;        /* enum line_mode */
+    int edge_sched;  /* arm the timer only for level transitions */
+    int abs_sched;   /* deadlines anchored to the start time; catch up if late */
+    u32 pdm_acc;     /* sigma-delta accumulator; owned by the timer callback */
     /* ----------------- */
+
+    struct line_io io;             /* fast path for the timer callbacks */
+    unsigned long overruns;  /* time slots/edges the callback ran too late for */
+    int count;       /* pulses to generate before stopping; 0 for no limit */
+    int pulses;      /* generated since the start; owned by the timer callback */
+    int brightness;  /* MODE_PDM: HIGH for brightness/PDM_MAX of the time slots */
+
+    /* NOTE: the pattern being played is only ever replaced while stopped;
+     * uploads go to pattern_staging, which is put into effect the next time
+     * the pulse train is started. See start_pattern(). */
+    struct line_pattern *pattern;
+    int pattern_pos;
+
+    /* NOTE: only used in edge-driven mode; in slot-driven mode, lines are
+     * driven by the timer of the line_group they belong to. timer.backend
+     * is the sysfs backend either way */
+    struct line_timer timer;
+    struct line_group *group;      /* NULL unless slot-driven and running */
+    unsigned int params_seen;      /* gen of the parameters in effect */
+    seqcount_raw_spinlock_t params_seq;
+
+    struct latency_stats latency;
+
+    struct list_head group_node;   /* in group->members */
+    struct gpio_descs *port;       /* parallel port; NULL for a single line */
+    struct line_capture *cap;      /* input line; NULL for outputs */
+    int done;        /* the count is reached or the pattern over; see line_done() */
+
+    /* requested parameters; see struct line_params */
+    struct line_params params;
+    struct line_ramp ramp;
+
+    /* IO_WORKER: level to be written by io_worker; see line_io_defer() */
+    struct llist_node io_node;     /* in io_pending */
+    atomic_t io_queued;            /* io_node is in io_pending */
+    int io_level;
+
+    /* streaming; see the character device section. The ring is allocated on
+     * first open and kept until the line goes away */
+    struct gpioman_ring *ring;
+    u32 ring_tail;               /* private copy; userspace may scribble on ring->tail */
+    atomic_t stream_stopped;     /* ran empty; see stream_step() and chardev_ioctl() */
+    struct irq_work ring_work;   /* wakes ring_wait up from the timer callback */
+
+    /* ---- cold from here on ---- */
+    struct kobject kobj ____cacheline_aligned;
+    const char *devname;  /* property read from the device tree */
+    u32 id;               /* index in 'lines'; 0 until registered */
+    bool exported;        /* has its sysfs directory; see line_export() */
+    struct gpio_line_state *sibling;  /* next line of the same DT node, if any */
+
+    struct line_dma *dma;          /* NULL if the DMA backend is unavailable */
+
+    /* hardware PWM offload; NULL if there is no 'pwms' in the DT */
+    struct pwm_device *pwm;
+    struct pinctrl *pwm_pinctrl;
+    struct pinctrl_state *pwm_pins;  /* the pin muxed to the PWM, if it needs to be */
+    bool pwm_on;                     /* pulse train offloaded to the PWM */
+
+    /* serializes sysfs writes */
+    struct mutex cfg_lock;
+    raw_spinlock_t params_lock;   /* serializes publishers of 'params' */
+
+    int phase;       /* time slots the waveform starts late by; see line_start_phased() */
+    bool start_pending;  /* to be started against an epoch; see start_all_lines() */
+    struct work_struct done_work;
+
+    struct line_pattern *pattern_staging;  /* see 'pattern' */
+    bool pattern_staged;
+
+    /* streaming, the process context side */
+    struct cdev cdev;
+    struct device *chardev;      /* /dev/gpioman/<devname>; see create_gls_chardev() */
+    wait_queue_head_t ring_wait;
+
+    struct dentry *debugfs_dir;
+};
+
+/*
+ * Slot-driven lines that have the same freq (and abs_sched and backend
+ * settings) share a single timer rather than each having their own. Every
+ * tick advances the state machine of all the member lines and then updates
+ * all of them with a single gpiod_set_array_value() call, which gpiolib
+ * turns into a single set_multiple() call per gpio chip -- or, if all of them
+ * are in the same bank of bcm2835 gpios, with one write each to the GPSET
+ * and GPCLR registers. Besides the cost of the timer interrupt being paid
+ * once rather than once per line, the edges of the member lines are thereby
+ * aligned with each other.
+ *
+ * Groups are created and destroyed automatically as lines start and stop
+ * pulse generation; see line_group_join() and line_group_leave(). */
+struct line_group {
+    struct list_head list;     /* in 'groups' */
+    struct list_head members;  /* gpio_line_state.group_node */
+
+    struct line_timer timer;
+
+    struct slot_timebase tb;
+    int abs_sched;
+
+    /* protects the members list and the arrays below, which the timer
+     * callback iterates over; writers only take it for joining/leaving.
+     * NOTE: raw since with the hard irq backend the callback runs in hard
+     * irq context even on PREEMPT_RT, where a spinlock_t would sleep */
+    raw_spinlock_t lock;
+
+    /* all members are IO_MMIO lines in the same bank; or some member is an
+     * IO_WORKER line, in which case all are written by io_worker. See
+     * line_group_update_io() */
+    bool mmio;
+    bool deferred;
+    void __iomem *set_reg;
+    void __iomem *clr_reg;
+
+    /* descs[i] and bit i of values correspond to the ith member */
+    unsigned int nmembers;
+    unsigned int capacity;
+    struct gpio_desc **descs;
+    unsigned long *values;
 };
 
 
-static LIST_HEAD(list);               /* track live gpio_line_state instances */
+#define MAX_LINES 4096  /* character device minors; see create_gls_chardev() */
+
+/*
+ * Live gpio_line_state instances, indexed by their id (from 1 up, in the
+ * order they were probed in), which is also their 'id' in sysfs. Walkers
+ * take lines_lock to keep the lines from being released under them; see
+ * start_all_lines(). */
+static DEFINE_XARRAY_ALLOC1(lines);
+static DEFINE_MUTEX(lines_lock);
+static struct kmem_cache *gls_cache;  /* gpio_line_state instances */
+static LIST_HEAD(groups);             /* track live line_group instances */
+static DEFINE_MUTEX(groups_lock);     /* serializes line_group join/leave */
+static LIST_HEAD(gpio_regs_maps);     /* live gpio_regs instances */
+static DEFINE_MUTEX(gpio_regs_lock);
 struct kobject *driver_sysfs_entry;   /* main driver sysfs dir */
+static dev_t chardev_region;          /* MAX_LINES minors; see create_gls_chardev() */
+static DEFINE_IDA(chardev_minors);
+static struct class *chardev_class;
+static struct dentry *debugfs_root;   /* main driver debugfs dir */
 
-static bool debug_mode = false;
-#define debug(fmt, ...)  if (debug_mode) message(fmt, ##__VA_ARGS__)
+/*
+ * Lines that can sleep (e.g. on I2C/SPI gpio expanders) cannot be written
+ * from the timer callbacks, which run in atomic context. The callbacks
+ * queue the new level instead and this worker writes all the pending lines
+ * with a single gpiod_set_array_value_cansleep() call, which gpiolib turns
+ * into one set_multiple() call -- i.e. one bus transaction -- per expander.
+ * See line_io_defer(). */
+static struct kthread_worker *io_worker;
+static struct kthread_work io_work;
+static LLIST_HEAD(io_pending);
+#define IO_BATCH 64   /* lines per gpiod_set_array_value_cansleep() call */
 
-#ifdef USE_HR_TIMERS
-static enum hrtimer_restart hr_interval_cb(struct hrtimer *timer){
-    struct gpio_line_state *gls;
-    debug("called hr interval callback");
+/*
+ * Backs the 'debug' driver attribute. A static key rather than a bool so
+ * that the disabled case costs nothing in the timer callbacks. NOTE: per-edge
+ * events are traced rather than logged; see gpioman_trace.h. */
+static DEFINE_STATIC_KEY_FALSE(debug_mode);
+#define debug(fmt, ...)  if (static_branch_unlikely(&debug_mode)) message(fmt, ##__VA_ARGS__)
 
-    gls = container_of(timer, struct gpio_line_state, timer);
+/* backs <debugfs>/gpioman/bench; see bench_record() */
+static DEFINE_STATIC_KEY_FALSE(bench_mode);
 
-    if (!gls->pin_ctl_enabled)  /* if status==0 in sysfs, always LOW */
-        return HRTIMER_NORESTART;
+static inline void line_params_sync(struct gpio_line_state *gls, bool boundary);
 
-    /*
-     * Simple state machine; a counter is incremented from 0 to
-     * (on_cycles + offcycles).
-     *  - while counter is between [0, on_cycles), drive the line HIGH.
-     *  - while counter is between [on_cycles, on_cycles+off_cycles),
-     *    drive the line LOW.  */
+/*
+ * The waveform has come to an end of its own ('count' pulses generated, or
+ * the pattern played once); called from the timer callback with the line
+ * LOW from here on. Pollers of 'done' are notified from process context. */
+static inline void line_done(struct gpio_line_state *gls){
+    if (READ_ONCE(gls->done)) return;
+
+    WRITE_ONCE(gls->done, 1);
+    schedule_work(&gls->done_work);
+}
+
+/*
+ * Slot-driven state machine, advanced once per time slot. A counter is
+ * incremented from 0 to (on_cycles + offcycles).
+ *  - while counter is between [0, on_cycles), drive the line HIGH.
+ *  - while counter is between [on_cycles, on_cycles+off_cycles),
+ *    drive the line LOW.  */
+static inline void slot_sched_step(struct gpio_line_state *gls){
     if (gls->pin_logic_level == LOGIC_HIGH){
         if (gls->counter++ == gls->on_cycles){
             /* if there are off cycles, then move state machine to the
              * off-cyles state; otherwise stay in on_cycles state: reset
              * counter and start over */
-            if (gls->off_cycles > 0) gls->pin_logic_level = LOGIC_LOW;
-            else gls->counter = 0;
+            if (gls->off_cycles > 0){
+                gls->pin_logic_level = LOGIC_LOW;
+                gls->pulses++;
+            }
+            else {
+                gls->counter = 0;
+                line_params_sync(gls, true);
+            }
         }
     }
     else if (gls->pin_logic_level == LOGIC_LOW){
@@ -105,209 +617,2965 @@ static enum hrtimer_restart hr_interval_cb(struct hrtimer *timer){
         BUG_ON(gls->off_cycles == 0);
 
         if (gls->counter++ == (gls->on_cycles + gls->off_cycles)){
+            /* done: stay at the end of the last period until taken out of
+             * the group; see done_work_func() */
+            if (gls->count && gls->pulses >= gls->count){
+                gls->counter--;
+                line_done(gls);
+                return;
+            }
+
             gls->pin_logic_level = LOGIC_HIGH;
 
             /* back to on_cycles state; counter is set to 1 because we're
              * switching to the on_cycles state right away, contributing 1 to
              * the counter (i.e. line is being set to be high for this cycle). */
             gls->counter = 1;
+            line_params_sync(gls, true);
         }
     }
+}
 
-    debug("LEVEL: %d  counter=%d", gls->pin_logic_level, gls->counter);
-    gpiod_set_value(gls->gpio_descriptor, gls->pin_logic_level);
+/*
+ * Edge-driven state machine, advanced only at level transitions: flip the
+ * line and return the number of time slots the new level is to be held for,
+ * i.e. how far in the future the timer must fire next.
+ * Returns 0 if the waveform has degenerated into a constant level
+ * (on_cycles==0 => always LOW; off_cycles==0 => always HIGH), in which
+ * case no timer is needed at all. */
+static inline int edge_sched_step(struct gpio_line_state *gls){
+    /* about to go back to the on_cycles state: period boundary */
+    if (gls->pin_logic_level == LOGIC_LOW) line_params_sync(gls, true);
 
-    hrtimer_forward_now(timer, ns_to_ktime((u64)gls->pulse_period * 1000));
-    return HRTIMER_RESTART;
+    if (gls->on_cycles == 0 || gls->off_cycles == 0){
+        gls->pin_logic_level = gls->on_cycles > 0 ? LOGIC_HIGH : LOGIC_LOW;
+        return 0;
+    }
+
+    if (gls->pin_logic_level == LOGIC_HIGH){
+        gls->pin_logic_level = LOGIC_LOW;
+        gls->pulses++;
+        return gls->off_cycles;
+    }
+
+    /* done: the line stays LOW and the timer stops */
+    if (gls->count && gls->pulses >= gls->count){
+        line_done(gls);
+        return 0;
+    }
+
+    gls->pin_logic_level = LOGIC_HIGH;
+    return gls->on_cycles;
+}
+
+/*
+ * Duration of the next 'slots' time slots, in timer units (units_per_sec).
+ *
+ * pulse_period is 1/freq rounded down to a whole number of timer units. The
+ * remainder of that division (pulse_period_rem, in 1/freq-ths of a unit) is
+ * accumulated in phase_acc DDS-style and an extra unit gets inserted every
+ * time the accumulator wraps. The average slot duration is therefore exactly
+ * 1/freq, even when freq does not evenly divide units_per_sec. */
+static inline u64 slots_to_interval(struct slot_timebase *tb, u64 slots){
+    u64 interval = slots * tb->pulse_period;
+    u64 acc, q;
+    u32 r;
+
+    if (slots == 1){  /* fast path; every tick in slot-driven mode */
+        tb->phase_acc += tb->pulse_period_rem;
+        if (tb->phase_acc >= tb->freq){
+            tb->phase_acc -= tb->freq;
+            interval++;
+        }
+        return interval;
+    }
+
+    /* split up to avoid overflowing slots * pulse_period_rem */
+    q = div_u64_rem(slots, tb->freq, &r);
+    acc = tb->phase_acc + (u64)r * tb->pulse_period_rem;
+    interval += q * tb->pulse_period_rem + div_u64_rem(acc, tb->freq, &tb->phase_acc);
+    return interval;
+}
+
+/* number of whole time slots in the given number of timer units */
+static inline u64 interval_to_slots(struct slot_timebase *tb, u64 interval){
+    return mul_u64_u32_div(interval, tb->freq, tb->units_per_sec);
 }
 
-#else  /* !USE_HR_TIMERS */
+static inline void set_timebase_frequency(struct slot_timebase *tb, u32 freq, u32 units_per_sec){
+    tb->units_per_sec = units_per_sec;
+    tb->freq = freq;
+    tb->pulse_period = freq > 0 ? units_per_sec / freq : 0;
+    tb->pulse_period_rem = freq > 0 ? units_per_sec % freq : 0;
+    tb->phase_acc = 0;
+}
+
+/* consistent snapshot of the requested parameters; never blocks */
+static inline void line_params_read(struct gpio_line_state *gls, struct line_params *p){
+    unsigned int seq;
+
+    do {
+        seq = read_seqcount_begin(&gls->params_seq);
+        *p = gls->params;
+    } while (read_seqcount_retry(&gls->params_seq, seq));
+}
 
 /*
- * refer to comments in the hr version of the callback function */
-static void lr_interval_cb(struct timer_list *timer){
-    struct gpio_line_state *gls;
-    debug("called lr interval callback");
+ * Publish new parameters for pick-up by line_params_sync(). NOTE: interrupts
+ * are disabled for the (tiny) write-side critical section since a reader
+ * interrupting it on the same CPU would otherwise spin forever. */
+static void line_params_publish_ramp(struct gpio_line_state *gls, u32 freq,
+        int on_cycles, int off_cycles, bool at_boundary, u32 ramp_ms, int curve)
+{
+    unsigned long flags;
 
-    gls = container_of(timer, struct gpio_line_state, timer);
+    raw_spin_lock_irqsave(&gls->params_lock, flags);
+    write_seqcount_begin(&gls->params_seq);
 
-    if (!gls->pin_ctl_enabled) return;
+    gls->params.freq = freq;
+    gls->params.on_cycles = on_cycles;
+    gls->params.off_cycles = off_cycles;
+    gls->params.at_boundary = at_boundary;
+    gls->params.ramp_ms = ramp_ms;
+    gls->params.curve = curve;
+    gls->params.gen++;
 
-    mod_timer(timer, jiffies + msecs_to_jiffies(gls->pulse_period));
+    write_seqcount_end(&gls->params_seq);
+    raw_spin_unlock_irqrestore(&gls->params_lock, flags);
+}
 
-    if (gls->pin_logic_level == LOGIC_HIGH){
-        if (gls->counter++ == gls->on_cycles){
-            if (gls->off_cycles > 0) gls->pin_logic_level = LOGIC_LOW;
-            else gls->counter = 0;
-        }
+static inline void line_params_publish(struct gpio_line_state *gls, u32 freq,
+        int on_cycles, int off_cycles, bool at_boundary)
+{
+    line_params_publish_ramp(gls, freq, on_cycles, off_cycles, at_boundary, 0, RAMP_LINEAR);
+}
+
+/* square root of on/(on+off), Q16 */
+static u32 ramp_sqrt_duty(int on, int off){
+    u64 period = (u64)on + off;
+
+    return period ? int_sqrt64(div64_u64((u64)on << 32, period)) : 0;
+}
+
+/* a + (b - a) * t, with t in Q16 */
+static inline s64 ramp_lerp(s64 a, s64 b, u32 t){
+    return a + div_s64((b - a) * t, 1 << 16);
+}
+
+/* put the settings in effect for the given point t (Q16) along the ramp */
+static void line_ramp_apply(struct gpio_line_state *gls, u32 t){
+    struct line_ramp *r = &gls->ramp;
+    u32 freq = ramp_lerp(r->freq0, r->freq1, t);
+    u64 period, duty, on, off;
+
+    if (t >= 1 << 16){  /* the end: exactly the target settings */
+        gls->on_cycles = r->on1;
+        gls->off_cycles = r->off1;
+        freq = r->freq1;
+        goto out;
     }
-    else if (gls->pin_logic_level == LOGIC_LOW){
-        BUG_ON(gls->off_cycles == 0);
 
-        if (gls->counter++ == (gls->on_cycles + gls->off_cycles)){
-            gls->pin_logic_level = LOGIC_HIGH;
-            gls->counter = 1;
-        }
+    if (r->curve == RAMP_GAMMA){
+        period = ramp_lerp((s64)r->on0 + r->off0, (s64)r->on1 + r->off1, t);
+        duty = ramp_lerp(r->duty0, r->duty1, t);
+        on = (period * (duty * duty >> 16)) >> 16;
+        off = period - on;
     }
+    else {
+        on = ramp_lerp(r->on0, r->on1, t);
+        off = ramp_lerp(r->off0, r->off1, t);
+    }
+
+    /* NOTE: on the way, never a constant level, which would stop the timer
+     * of an edge-driven line and with it the ramp */
+    gls->on_cycles = clamp_t(u64, on, 1, INT_MAX);
+    gls->off_cycles = clamp_t(u64, off, 1, INT_MAX);
 
-    debug("LEVEL: %d  counter=%d", gls->pin_logic_level, gls->counter);
-    gpiod_set_value(gls->gpio_descriptor, gls->pin_logic_level);
+out:
+
+    /* NOTE: slot-driven lines only get a ramp at the freq of their group */
+    if (freq != gls->tb.freq)
+        set_timebase_frequency(&gls->tb, freq, gls->tb.units_per_sec);
 }
-#endif   /* USE_HR_TIMERS */
 
+/* start ramping from the settings in effect to the given ones */
+static void line_ramp_begin(struct gpio_line_state *gls, struct line_params *p){
+    struct line_ramp *r = &gls->ramp;
 
-/* =================================================
- * ==== Generic sysfs operation callbacks ==========
- * =================================================
- * - these are called for the default attributes created
- *   in sysfs by this module, for each device (gpio line)
- *   managed.
- * -----------------------------------------------*/
+    r->curve = p->curve;
+    r->start_ns = ktime_get_ns();
+    r->duration_ns = (u64)p->ramp_ms * NSEC_PER_MSEC;
+    r->freq0 = gls->tb.freq;          r->freq1 = p->freq;
+    r->on0 = gls->on_cycles;          r->on1 = p->on_cycles;
+    r->off0 = gls->off_cycles;        r->off1 = p->off_cycles;
+    r->duty0 = ramp_sqrt_duty(r->on0, r->off0);
+    r->duty1 = ramp_sqrt_duty(r->on1, r->off1);
+    WRITE_ONCE(r->active, true);
+}
 
-/* called when user reads sysfs attribute */
-static ssize_t read_sysfs_attribute(
-        struct kobject *kobj,
-        struct kobj_attribute *kattr,
-        char *buf)
-{
-	int var;
-    const char *attribute = kattr->attr.name;
-    struct gpio_line_state *gls = container_of(kobj, struct gpio_line_state, kobj);
+/* take the next step along the ramp; at a composite-period boundary */
+static void line_ramp_step(struct gpio_line_state *gls){
+    struct line_ramp *r = &gls->ramp;
+    u64 elapsed = ktime_get_ns() - r->start_ns;
 
-    debug("called read_sysfs_attribute");
+    if (elapsed >= r->duration_ns){
+        line_ramp_apply(gls, 1 << 16);
+        WRITE_ONCE(r->active, false);
+        return;
+    }
 
-    if (match(attribute, "status"))           var = gls->pin_ctl_enabled;
-    else if (match(attribute, "on_cycles"))   var = gls->on_cycles;
-    else if (match(attribute, "off_cycles"))  var = gls->off_cycles;
+    line_ramp_apply(gls, div64_u64(elapsed << 16, r->duration_ns));
+}
 
-    else if (match(attribute, "freq")){
-#ifdef USE_HR_TIMERS
-        var = US_PER_SEC/gls->pulse_period;
-#else
-        var = MS_PER_SEC/gls->pulse_period;
-#endif
+/*
+ * Put newly published parameters into effect, if any. Called by the timer
+ * callback every time slot (or transition, if edge-driven), with 'boundary'
+ * telling whether the line is at a composite-period boundary; and with the
+ * pulse train stopped, when it is always safe to. Parameters not published
+ * for the boundary restart the state machine from the on_cycles state.
+ * NOTE: freq only ever changes here for edge-driven lines; slot-driven lines
+ * use the timebase of their group, so a new freq is applied to those by
+ * restarting the pulse train instead. */
+static inline void line_params_sync(struct gpio_line_state *gls, bool boundary){
+    struct line_params p;
+
+    if (unlikely(gls->ramp.active) && boundary) line_ramp_step(gls);
+    if (likely(READ_ONCE(gls->params.gen) == gls->params_seen)) return;
+
+    line_params_read(gls, &p);
+    if (p.at_boundary && !boundary) return;
+
+    /* new parameters replace any ramp under way */
+    WRITE_ONCE(gls->ramp.active, false);
+    if (p.ramp_ms){
+        line_ramp_begin(gls, &p);
+        WRITE_ONCE(gls->params_seen, p.gen);
+        return;
+    }
+
+    gls->on_cycles = p.on_cycles;
+    gls->off_cycles = p.off_cycles;
+    if (p.freq != gls->tb.freq)
+        set_timebase_frequency(&gls->tb, p.freq, gls->tb.units_per_sec);
+
+    if (!p.at_boundary){
+        gls->counter = 0;
+        gls->pin_logic_level = LOGIC_HIGH;
     }
 
-	return sprintf(buf, "%u\n", var);
+    WRITE_ONCE(gls->params_seen, p.gen);
 }
 
 /*
- * The frquency freq is specified in microseconds when using high-res timers;
- * otherwise it is specified in millisecondfor convenience when using low-res
- * timers, but note that even milliseconds are too granular since the resolution
- * is at best that of the jiffy.
- * Specifically, if the kernel HZ variable is e.g 250 then it's pointless
- * for the user to set a higher value than that for the frequency in sysfs.
- * The callback will not be invoked more than HZ times a second.
- *
- * NOTE: the HZ is a compile-time constant set in kconfig. It can be checked
- * at the command line like this:
- *    cat /boot/config-$(uname -r) | grep -i 'HZ='
- * -- assuming the kernel .config is stored there for the platform.
- */
-void set_gls_frequency(struct gpio_line_state *gls, int freq){
-#ifdef USE_HR_TIMERS
-    /* user should use common sense: the kernel will certainly not be
-    * calling the callback every microsecond, especially on a busy
-    * system! */
-    gls->pulse_period = freq > 0 ? US_PER_SEC / freq : 0;
-#else
-    /* use the jiffy if user has specified a higher freq than that since
-     * you cannot get a more granular resolution than the jiffy */
-    if (freq > KERNEL_HERTZ){
-        message("Frequency setting cannot be met; defaulting to HZ (%u)",
-                KERNEL_HERTZ);
-        freq = KERNEL_HERTZ;
-    }
-    gls->pulse_period = freq > 0 ? MS_PER_SEC / freq : 0;
-#endif
+ * Start the slot-driven state machine 'phase' time slots behind in its
+ * period, for the line to keep the same phase offset to the other lines
+ * started along with it as a line with a timer of its own would (see
+ * line_start_phased()); only it is not held LOW in the meantime, since the
+ * timer is that of the group. The state is set to that of the slot before the
+ * first one to be played, which is (-phase) mod (on_cycles + off_cycles):
+ * after a step, counter is 1 + the slot within the period, the line being
+ * HIGH for counter <= on_cycles. NOTE: only meaningful with both on and off
+ * cycles; and a phase of a whole number of periods changes nothing. */
+static void slot_sched_phase(struct gpio_line_state *gls){
+    u32 period = gls->on_cycles + gls->off_cycles, first;
 
-    if (gls->pin_ctl_enabled){
-        gpiod_set_value(gls->gpio_descriptor, LOGIC_HIGH);
-        /* if freq>0 and status=1, start timer in case it was disabled;
-         * else if freq=0, no timer needed so cancel in case it's running. */
-#ifdef USE_HR_TIMERS
-        if (freq > 0){
-            hrtimer_start(&gls->timer, ms_to_ktime(0), HRTIMER_MODE_REL);
-        } else { hrtimer_cancel(&gls->timer); }
-#else
-        if (freq > 0){
-            mod_timer(&gls->timer, jiffies + msecs_to_jiffies(gls->pulse_period));
-        } else { del_timer(&gls->timer); }
-#endif
+    if (!gls->phase || !gls->on_cycles || !gls->off_cycles) return;
+    if (!(first = (period - gls->phase % period) % period)) return;
+
+    gls->counter = first;
+    gls->pin_logic_level = first <= gls->on_cycles ? LOGIC_HIGH : LOGIC_LOW;
+}
+
+/*
+ * How many whole periods a catch-up may skip, each counting as a pulse,
+ * without going past 'count': the pulses still to go, less the one that a
+ * line now HIGH completes by going LOW after the skip. None if 'count' was
+ * lowered below the pulses already generated. */
+static inline u64 sched_skip_max(const struct gpio_line_state *gls){
+    int left = gls->count - gls->pulses - (gls->pin_logic_level == LOGIC_HIGH);
+
+    return max(left, 0);
+}
+
+/*
+ * Absolute-deadline catch-up for the slot-driven state machine: 'slots' time
+ * slots (>= 1) have elapsed since the callback last ran, so advance the state
+ * machine by that many steps rather than just one. Anything beyond the first
+ * slot was missed (the callback ran too late) and is counted as an overrun.
+ * NOTE: the state machine repeats every on_cycles+off_cycles steps, so a long
+ * stall never costs more than two composite periods worth of steps here
+ * (each period skipped still counting as a pulse towards 'count'). */
+static void slot_sched_advance(struct gpio_line_state *gls, u64 slots){
+    u64 period = (u64)gls->on_cycles + gls->off_cycles;
+    u64 skip;
+    u32 rem;
+
+    if (!slots) return;
+    gls->overruns += slots - 1;
+
+    if (period > 0 && period <= U32_MAX && slots > 2 * period){
+        skip = div_u64_rem(slots, period, &rem) - 1;
+        if (gls->count) skip = min(skip, sched_skip_max(gls));
+        if (gls->off_cycles > 0) gls->pulses += skip;
+        slots -= skip * period;
     }
+
+    while (slots-- && !gls->done) slot_sched_step(gls);
 }
 
-/* called when user writes to sysfs attribute */
-static ssize_t write_sysfs_attribute(
-        struct kobject *kobj,
-        struct kobj_attribute *kattr,
-        const char *buf, size_t count)
-{
-	int var, rc;
-    struct gpio_line_state *gls;
-    const char *attribute = kattr->attr.name;
-	rc = kstrtoint(buf, 10, &var);
+/*
+ * Absolute-deadline catch-up for slot-driven scheduling, given that the
+ * callback is running 'late' timer units after the deadline that just
+ * expired: stores the number of slots that have elapsed in *slots and returns
+ * the offset of the first deadline still in the future. */
+static u64 slot_sched_catch_up(struct slot_timebase *tb, u64 late, u64 *slots){
+    u64 next;
+
+    *slots = 1;
+    if ((next = slots_to_interval(tb, 1)) <= late){
+        *slots += interval_to_slots(tb, late - next);
+        next += slots_to_interval(tb, *slots - 1);
+
+        /* rounding: at most one more to go */
+        while (next <= late){
+            next += slots_to_interval(tb, 1);
+            (*slots)++;
+        }
+    }
+
+    return next;
+}
+
+/*
+ * Absolute-deadline variant of edge_sched_step(). The callback is running
+ * 'late' timer units after the deadline of the transition it was armed for.
+ * Applies every transition whose deadline has already passed and returns
+ * the offset of the next transition relative to the deadline that just
+ * expired (0 if the level is constant from now on, like edge_sched_step()).
+ * Missed transitions are counted as overruns. */
+static u64 edge_sched_advance(struct gpio_line_state *gls, u64 late){
+    u64 next, composite, k;
+    int cycles;
+
+    if (!(cycles = edge_sched_step(gls))) return 0;
+
+    next = slots_to_interval(&gls->tb, cycles);
+    if (next > late) return next;  /* on time */
+
+    /* skip whole composite periods first so a long stall is not replayed
+     * edge by edge; that's 2 transitions per composite period */
+    composite = (u64)gls->on_cycles + gls->off_cycles;
+    k = div64_u64(interval_to_slots(&gls->tb, late - next), composite);
+    if (gls->count) k = min(k, sched_skip_max(gls));
+    if (k > 0){
+        next += slots_to_interval(&gls->tb, k * composite);
+        gls->overruns += 2 * k;
+        gls->pulses += k;
+    }
+
+    while (next <= late){
+        if (!(cycles = edge_sched_step(gls))) return 0;
+        next += slots_to_interval(&gls->tb, cycles);
+        gls->overruns++;
+    }
+
+    return next;
+}
+
+/*
+ * Duration and level of a pattern or ring entry. Those of a parallel port are
+ * words to be put out one per time slot instead: bit i drives the i-th line. */
+static inline u32 entry_slots(const struct gpio_line_state *gls, u32 e){
+    return gls->port ? 1 : PATTERN_SLOTS(e);
+}
+
+static inline int entry_level(const struct gpio_line_state *gls, u32 e){
+    return gls->port ? e : PATTERN_LEVEL(e);
+}
+
+/*
+ * Pattern playback (mode != MODE_PULSE) counterpart of edge_sched_step():
+ * move on to the next entry of the pattern, taking on its level, and return
+ * its duration in time slots. Entries of duration 0 are skipped. At the end
+ * of the pattern, playback starts over in MODE_PATTERN_LOOP; otherwise the
+ * line goes LOW and 0 is returned. */
+static int pattern_step(struct gpio_line_state *gls){
+    struct line_pattern *pat = gls->pattern;
+    u32 e;
+
+    /* NOTE: terminates since start_pattern() made sure nsteps > 0 */
+    do {
+        if (++gls->pattern_pos >= pat->len){
+            if (gls->mode != MODE_PATTERN_LOOP){
+                gls->pin_logic_level = LOGIC_LOW;
+                line_done(gls);
+                return 0;
+            }
+            gls->pattern_pos = 0;
+        }
+        e = pat->entries[gls->pattern_pos];
+    } while (!entry_slots(gls, e));
+
+    gls->pin_logic_level = entry_level(gls, e);
+    return entry_slots(gls, e);
+}
+/*
+ * Streaming (MODE_STREAM) counterpart of pattern_step(): consume the next
+ * entry from the ring. If the ring has run empty, the line goes LOW and 0 is
+ * returned, stopping the timer until userspace kicks the stream off again.
+ * NOTE: head is written by userspace and so cannot be trusted: the index is
+ * masked, a head more than a ring's worth ahead is taken as empty and no more
+ * than a ring's worth of zero-duration entries are skipped in one go. */
+static int stream_step(struct gpio_line_state *gls){
+    struct gpioman_ring *ring = gls->ring;
+    u32 head, tail = gls->ring_tail, used, e = 0, slots = 0;
+    int budget = GPIOMAN_RING_ENTRIES;
+
+again:
+    /* pairs with the userspace release of head after filling entries */
+    head = smp_load_acquire(&ring->head);
+    used = head - tail;
+
+    while (used > 0 && used <= GPIOMAN_RING_ENTRIES && budget-- > 0){
+        e = READ_ONCE(ring->entries[tail++ % GPIOMAN_RING_ENTRIES]);
+        if ((slots = entry_slots(gls, e))) break;
+
+        if (tail == head){
+            head = smp_load_acquire(&ring->head);
+            used = head - tail;
+        }
+    }
+
+    /* the entries up to tail are free for userspace to reuse */
+    gls->ring_tail = tail;
+    smp_store_release(&ring->tail, tail);
+
+    if (!slots){
+        /* Ran empty: stop. Entries may have been produced since head was
+         * read, with the kick that followed them having come too early to
+         * see the flag; hence head is checked once more after setting it
+         * (the barrier pairs with the one in chardev_ioctl()). If there are
+         * any, whoever clears the flag first carries on. */
+        atomic_set(&gls->stream_stopped, 1);
+        WRITE_ONCE(ring->flags, GPIOMAN_RING_STOPPED);
+        smp_mb__after_atomic();
+
+        used = READ_ONCE(ring->head) - tail;
+        if (used > 0 && used <= GPIOMAN_RING_ENTRIES && budget > 0
+                && atomic_cmpxchg(&gls->stream_stopped, 1, 0) == 1){
+            WRITE_ONCE(ring->flags, 0);
+            goto again;
+        }
+
+        gls->pin_logic_level = LOGIC_LOW;
+        irq_work_queue(&gls->ring_work);
+        return 0;
+    }
+
+    /* wake pollers up as the ring drops to half full */
+    if (used > GPIOMAN_RING_ENTRIES / 2 && head - tail <= GPIOMAN_RING_ENTRIES / 2)
+        irq_work_queue(&gls->ring_work);
+
+    gls->pin_logic_level = entry_level(gls, e);
+    return slots;
+}
+
+/*
+ * Pulse-density modulation (MODE_PDM) counterpart of edge_sched_step(): a
+ * first-order sigma-delta modulator. Each time slot adds brightness to the
+ * accumulator and the line is HIGH for the slots in which it overflows
+ * PDM_MAX, such that the HIGH slots are spread out as evenly as they can be
+ * -- the shortest possible period for any brightness. Rather than running
+ * the accumulator slot by slot, the length of the run of slots at the same
+ * level is worked out in one go, so the timer only fires at the transitions.
+ * A new brightness is picked up at the next transition. Returns 0 at
+ * brightness 0 and PDM_MAX, i.e. constant levels. */
+static int pdm_step(struct gpio_line_state *gls){
+    u32 b = READ_ONCE(gls->brightness), c = PDM_MAX - b, acc = gls->pdm_acc, k;
+
+    if (b == 0 || c == 0){
+        gls->pin_logic_level = b ? LOGIC_HIGH : LOGIC_LOW;
+        return 0;
+    }
+
+    if (acc >= c){
+        /* overflowing: HIGH as long as acc >= c, each slot taking c off */
+        k = acc / c;
+        gls->pdm_acc = acc - k * c;
+        gls->pin_logic_level = LOGIC_HIGH;
+    }
+    else {
+        /* LOW until acc gets to c, each slot adding b */
+        k = (c - acc - 1) / b + 1;
+        gls->pdm_acc = acc + k * b;
+        gls->pin_logic_level = LOGIC_LOW;
+    }
+
+    return k;
+}
+
+/* run the accumulator over n time slots without driving the line */
+static void pdm_skip(struct gpio_line_state *gls, u64 n){
+    u32 b = READ_ONCE(gls->brightness), acc;
+
+    div_u64_rem(gls->pdm_acc + n * b, PDM_MAX, &acc);
+    gls->pdm_acc = acc;
+
+    /* two transitions per HIGH slot (or LOW slot, if fewer) */
+    gls->overruns += div_u64(2 * n * min_t(u32, b, PDM_MAX - b), PDM_MAX);
+}
+
+/* next transition as per the mode of the line */
+static inline int line_step(struct gpio_line_state *gls){
+    switch (gls->mode){
+    case MODE_PULSE:  return edge_sched_step(gls);
+    case MODE_STREAM: return stream_step(gls);
+    case MODE_PDM:    return pdm_step(gls);
+    default:          return pattern_step(gls);
+    }
+}
+
+/*
+ * Absolute-deadline variant of pattern_step(), stream_step() and pdm_step();
+ * see edge_sched_advance(). */
+static u64 pattern_advance(struct gpio_line_state *gls, u64 late){
+    u64 next, k;
+    int slots;
+
+    if (!(slots = line_step(gls))) return 0;
+
+    next = slots_to_interval(&gls->tb, slots);
+    if (next > late) return next;  /* on time */
+
+    /* skip whole passes over the pattern first when looping */
+    if (gls->mode == MODE_PATTERN_LOOP){
+        k = div64_u64(interval_to_slots(&gls->tb, late - next), gls->pattern->total_slots);
+        if (k > 0){
+            next += slots_to_interval(&gls->tb, k * gls->pattern->total_slots);
+            gls->overruns += k * gls->pattern->nsteps;
+        }
+    }
+
+    /* and the accumulator over all the slots missed */
+    if (gls->mode == MODE_PDM){
+        k = interval_to_slots(&gls->tb, late - next);
+        if (k > 0){
+            next += slots_to_interval(&gls->tb, k);
+            pdm_skip(gls, k);
+        }
+    }
+
+    while (next <= late){
+        if (!(slots = line_step(gls))) return 0;
+        next += slots_to_interval(&gls->tb, slots);
+        gls->overruns++;
+    }
+
+    return next;
+}
+
+static inline u64 line_advance(struct gpio_line_state *gls, u64 late){
+    return gls->mode == MODE_PULSE ? edge_sched_advance(gls, late) : pattern_advance(gls, late);
+}
+
+/*
+ * Record how late (in ns) a timer callback ran relative to its scheduled
+ * expiry. Only ever called from the timer callback driving the line, so
+ * there is a single writer and no locking; readers (debugfs) may see a
+ * slightly inconsistent snapshot, which is fine for statistics.
+ * Resets are requested by bumping reset_req and carried out here, by the
+ * writer, the next time it runs. */
+static inline void latency_record(struct latency_stats *st, u64 late_ns){
+    unsigned int req = atomic_read(&st->reset_req);
+    unsigned int b = late_ns ? min(fls64(late_ns), LATENCY_BUCKETS - 1) : 0;
+
+    if (unlikely(req != st->reset_seen)){
+        memset(st->hist, 0, sizeof(st->hist));
+        st->count = st->sum = st->max = 0;
+        st->min = U64_MAX;
+        st->bench_count = st->cost_sum = st->cost_max = st->edges = 0;
+        st->reset_seen = req;
+    }
+
+    WRITE_ONCE(st->hist[b], st->hist[b] + 1);
+    WRITE_ONCE(st->count, st->count + 1);
+    WRITE_ONCE(st->sum, st->sum + late_ns);
+    if (late_ns < st->min) WRITE_ONCE(st->min, late_ns);
+    if (late_ns > st->max) WRITE_ONCE(st->max, late_ns);
+}
+
+/*
+ * Benchmarking: with bench_mode on, the timer callbacks take the time as they
+ * start (t0; 0 if off) and record the time they took and the edges they made
+ * when done, for the achieved edge rate and the cost per callback to be
+ * worked out from. Same rules as for latency_record(), which must have been
+ * called first. */
+static inline u64 bench_start(void){
+    return static_branch_unlikely(&bench_mode) ? ktime_get_ns() : 0;
+}
+
+static inline void bench_record(struct latency_stats *st, u64 t0, unsigned int edges){
+    u64 now = ktime_get_ns(), cost = now - t0;
+
+    if (!st->bench_count) WRITE_ONCE(st->bench_first, t0);
+    WRITE_ONCE(st->bench_last, now);
+    WRITE_ONCE(st->bench_count, st->bench_count + 1);
+    WRITE_ONCE(st->cost_sum, st->cost_sum + cost);
+    if (cost > st->cost_max) WRITE_ONCE(st->cost_max, cost);
+    WRITE_ONCE(st->edges, st->edges + edges);
+}
+
+/*
+ * Queue the line for io_worker to set to the given level; the caller kicks
+ * the worker. If the level changes again before the worker gets to the line,
+ * only the latest one is written. */
+static inline void line_io_defer(struct gpio_line_state *gls, int level){
+    WRITE_ONCE(gls->io_level, level);
+
+    /* NOTE: full barrier; pairs with the one in io_work_func() */
+    if (!atomic_xchg(&gls->io_queued, 1))
+        llist_add(&gls->io_node, &io_pending);
+}
+
+/* write out all pending IO_WORKER lines */
+static void io_work_func(struct kthread_work *work){
+    struct gpio_desc *descs[IO_BATCH];
+    DECLARE_BITMAP(values, IO_BATCH);
+    struct llist_node *pending = llist_del_all(&io_pending);
+    struct gpio_line_state *gls, *next;
+    unsigned int n = 0;
+
+    llist_for_each_entry_safe(gls, next, pending, io_node){
+        /* from here on a new level queues the line again */
+        atomic_set(&gls->io_queued, 0);
+        smp_mb__after_atomic();
+
+        descs[n] = gls->gpio_descriptor;
+        __assign_bit(n, values, READ_ONCE(gls->io_level));
+
+        if (++n == IO_BATCH){
+            gpiod_set_array_value_cansleep(n, descs, NULL, values);
+            n = 0;
+        }
+    }
+
+    if (n) gpiod_set_array_value_cansleep(n, descs, NULL, values);
+}
+
+/* map the registers of the controller, or take another reference to them */
+static struct gpio_regs *gpio_regs_get(struct device_node *np){
+    struct gpio_regs *regs;
+
+    mutex_lock(&gpio_regs_lock);
+
+    list_for_each_entry(regs, &gpio_regs_maps, list){
+        if (regs->np == np) goto found;
+    }
+
+    if (!(regs = kzalloc(sizeof(struct gpio_regs), GFP_KERNEL))) goto out;
+
+    /* NOTE: the registers are mapped by the gpio driver too; a mapping of
+     * our own is harmless and spares us from reaching into that */
+    if (!(regs->base = of_iomap(np, 0))){
+        kfree(regs);
+        regs = NULL;
+        goto out;
+    }
+
+    regs->np = of_node_get(np);
+    list_add(&regs->list, &gpio_regs_maps);
+
+found:
+    regs->users++;
+out:
+    mutex_unlock(&gpio_regs_lock);
+    return regs;
+}
+
+static void gpio_regs_put(struct gpio_regs *regs){
+    if (!regs) return;
+
+    mutex_lock(&gpio_regs_lock);
+    if (!--regs->users){
+        list_del(&regs->list);
+        iounmap(regs->base);
+        of_node_put(regs->np);
+        kfree(regs);
+    }
+    mutex_unlock(&gpio_regs_lock);
+}
+
+/* drive the line from a timer callback; see struct line_io */
+static inline void line_io_set(struct gpio_line_state *gls, int level){
+    struct line_io *io = &gls->io;
+    int raw = level ^ io->active_low;
+
+    switch (io->kind){
+    case IO_PORT: {
+        unsigned long word = (u32)level;
+
+        gpiod_set_array_value(gls->port->ndescs, gls->port->desc, gls->port->info, &word);
+        return;
+    }
+    case IO_WORKER:
+        line_io_defer(gls, level);
+        kthread_queue_work(io_worker, &io_work);
+        return;
+    case IO_MMIO:
+        writel_relaxed(io->mask, raw ? io->set_reg : io->clr_reg);
+        return;
+    case IO_CHIP:
+        io->chip->set(io->chip, io->offset, raw);
+        return;
+    default:
+        gpiod_set_value(gls->gpio_descriptor, level);
+    }
+}
+
+/* drive the line (or port) from process context */
+static void line_write(struct gpio_line_state *gls, int level){
+    unsigned long word = (u32)level;
+
+    if (gls->port)
+        gpiod_set_array_value_cansleep(gls->port->ndescs, gls->port->desc, gls->port->info, &word);
+    else
+        gpiod_set_value_cansleep(gls->gpio_descriptor, level);
+}
+
+static void put_line_gpios(struct gpio_desc *desc, struct gpio_descs *port){
+    if (port) gpiod_put_array(port);
+    else gpiod_put(desc);
+}
+
+/*
+ * Advance the state machine of every member of the group by 'slots' time
+ * slots and update all the member lines in one go. 'missed' is the number
+ * of slots that were skipped without being caught up on (i.e. when not in
+ * absolute-deadline mode); 'late_ns' is the lateness of the tick; 't0' is
+ * as per bench_start(). */
+static void line_group_tick(struct line_group *grp, u64 slots, u64 missed, u64 late_ns, u64 t0){
+    struct gpio_line_state *gls;
+    unsigned int i = 0;
+    u32 set = 0, clr = 0;
+    bool edge;
+
+    raw_spin_lock(&grp->lock);
+
+    trace_gpioman_timer_fire(grp->tb.freq, late_ns, slots, grp->nmembers);
+
+    list_for_each_entry(gls, &grp->members, group_node){
+        latency_record(&gls->latency, late_ns);
+        line_params_sync(gls, false);
+        slot_sched_advance(gls, slots);
+        gls->overruns += missed;
+
+        if ((edge = test_bit(i, grp->values) != gls->pin_logic_level))
+            trace_gpioman_edge(gls->devname, gls->pin_logic_level);
+        if (t0) WRITE_ONCE(gls->latency.edges, gls->latency.edges + edge);
+        __assign_bit(i++, grp->values, gls->pin_logic_level);
+
+        if (grp->deferred) line_io_defer(gls, gls->pin_logic_level);
+        else if (gls->pin_logic_level ^ gls->io.active_low) set |= gls->io.mask;
+        else clr |= gls->io.mask;
+    }
+
+    if (grp->mmio){
+        if (set) writel_relaxed(set, grp->set_reg);
+        if (clr) writel_relaxed(clr, grp->clr_reg);
+    }
+    else if (grp->deferred) kthread_queue_work(io_worker, &io_work);
+    else gpiod_set_array_value(grp->nmembers, grp->descs, NULL, grp->values);
+
+    /* NOTE: the cost of the tick is that of each member's callback; the
+     * edges are already counted */
+    if (t0){
+        list_for_each_entry(gls, &grp->members, group_node)
+            bench_record(&gls->latency, t0, 0);
+    }
+
+    raw_spin_unlock(&grp->lock);
+}
+
+/*
+ * Trace a callback of a line with a timer of its own: 'slots' transitions
+ * were made, the line having been at level 'prev' before. NOTE: only level
+ * changes are edges; see gpioman_trace.h. */
+static inline void line_trace_fire(struct gpio_line_state *gls, u64 late_ns, u64 slots, int prev){
+    trace_gpioman_timer_fire(gls->tb.freq, late_ns, slots, 1);
+    if (gls->pin_logic_level != prev)
+        trace_gpioman_edge(gls->devname, gls->pin_logic_level);
+}
+
+/* ==== high-res backends ==== */
+
+/*
+ * The deadline the timer stands for: the (soft) expiry, plus whatever the
+ * timer was armed early by. */
+static inline ktime_t hr_timer_deadline(struct line_timer *t){
+    return ktime_add_ns(hrtimer_get_softexpires(&t->hr),
+            t->comp ? t->comp_ns[t->comp_idx] : 0);
+}
+
+/* how far past its deadline the timer callback is running, in ns */
+static inline u64 hr_timer_lateness(struct line_timer *t, ktime_t deadline){
+    ktime_t now = hrtimer_cb_get_time(&t->hr);
+
+    return ktime_after(now, deadline) ? ktime_to_ns(ktime_sub(now, deadline)) : 0;
+}
+
+/*
+ * Latency compensation (compensate=1). Even on time, a timer callback only
+ * gets the line written some time after the expiry -- interrupt entry, the
+ * hrtimer core, the state machine -- and not the same time for either level.
+ * Each timer hence keeps a running average, per level, of how late the write
+ * of the edges of that level was relative to their deadline, and is armed
+ * that much ahead of the deadline of the next edge. That is, the average is
+ * of the residual error once the compensation is applied, which it is
+ * corrected by: a write that was late adds to the compensation, an early one
+ * takes off it, each by 1/2^COMP_GAIN_SHIFT of the error.
+ * Called right after the write, with the timer already re-armed for the next
+ * deadline -- as early as for the one that expired -- and 'next' the level of
+ * the next edge (0 for timers whose edges are not HIGH/LOW). NOTE: the first
+ * edge after a start is taken as a LOW one. */
+static void hr_comp_update(struct line_timer *t, ktime_t deadline, unsigned int next){
+    u64 applied = t->comp_ns[t->comp_idx];
+    s64 err = ktime_to_ns(ktime_sub(ktime_get(), deadline));
+    s64 comp = (s64)applied + err / (1 << COMP_GAIN_SHIFT);
+
+    t->comp_ns[t->comp_idx] = clamp_t(s64, comp, 0, COMP_MAX_NS);
+    t->comp_idx = next;
+
+    hrtimer_set_expires_range_ns(&t->hr, ktime_sub_ns(ktime_add_ns(
+                    hrtimer_get_softexpires(&t->hr), applied), t->comp_ns[next]), t->slack);
+}
+
+/* the level of the next edge of the line; see hr_comp_update() */
+static inline unsigned int hr_comp_next(struct gpio_line_state *gls){
+    return gls->port ? 0 : !gls->pin_logic_level;
+}
+
+/*
+ * Edge-driven scheduling (edge_sched=1) and pattern playback; timer is per
+ * line. */
+static enum hrtimer_restart hr_interval_cb(struct hrtimer *timer){
+    struct gpio_line_state *gls;
+    u64 late, next, overruns, t0 = bench_start();
+    int cycles, prev;
+    ktime_t deadline;
+
+    gls = container_of(timer, struct gpio_line_state, timer.hr);
+
+    if (!gls->pin_ctl_enabled)  /* if status==0 in sysfs, always LOW */
+        return HRTIMER_NORESTART;
+
+    deadline = hr_timer_deadline(&gls->timer);
+    late = hr_timer_lateness(&gls->timer, deadline);
+    latency_record(&gls->latency, late);
+    prev = gls->pin_logic_level;
+
+    /* absolute-deadline scheduling: the schedule is a fixed grid anchored
+     * to the time the pulse train was started, so deadlines missed because
+     * the callback ran late are caught up on and accounted for rather than
+     * silently dropped */
+    if (gls->abs_sched){
+        /* each transition caught up on beyond the first is an overrun */
+        overruns = gls->overruns;
+        next = line_advance(gls, late);
+        if (next) hrtimer_add_expires_ns(timer, next);
+
+        line_trace_fire(gls, late, 1 + gls->overruns - overruns, prev);
+        line_io_set(gls, gls->pin_logic_level);
+        if (next && gls->timer.comp) hr_comp_update(&gls->timer, deadline, hr_comp_next(gls));
+        if (t0) bench_record(&gls->latency, t0, prev != gls->pin_logic_level);
+        return next ? HRTIMER_RESTART : HRTIMER_NORESTART;
+    }
+
+    cycles = line_step(gls);
+
+    line_trace_fire(gls, late, 1, prev);
+    line_io_set(gls, gls->pin_logic_level);
+    if (t0) bench_record(&gls->latency, t0, prev != gls->pin_logic_level);
+
+    if (!cycles)  /* constant level from here on; no more timer */
+        return HRTIMER_NORESTART;
+
+    /* NOTE: this drops any transitions missed in the meantime; only the
+     * count is kept track of */
+    gls->overruns += hrtimer_forward_now(timer,
+            ns_to_ktime(slots_to_interval(&gls->tb, cycles))) - 1;
+    if (gls->timer.comp) hr_comp_update(&gls->timer, deadline, hr_comp_next(gls));
+    return HRTIMER_RESTART;
+}
+
+/*
+ * Slot-driven scheduling (edge_sched=0); timer is shared by the group. */
+static enum hrtimer_restart hr_group_cb(struct hrtimer *timer){
+    struct line_group *grp;
+    u64 late, slots = 1, missed = 0, t0 = bench_start();
+    ktime_t deadline;
+
+    grp = container_of(timer, struct line_group, timer.hr);
+    deadline = hr_timer_deadline(&grp->timer);
+    late = hr_timer_lateness(&grp->timer, deadline);
+
+    if (grp->abs_sched){
+        hrtimer_add_expires_ns(timer, slot_sched_catch_up(&grp->tb, late, &slots));
+    } else {
+        missed = hrtimer_forward_now(timer, ns_to_ktime(slots_to_interval(&grp->tb, 1))) - 1;
+    }
+
+    line_group_tick(grp, slots, missed, late, t0);
+
+    /* NOTE: the members' edges come at every tick, of either level */
+    if (grp->timer.comp) hr_comp_update(&grp->timer, deadline, 0);
+    return HRTIMER_RESTART;
+}
+
+/* ==== low-res backend ==== */
+
+/* how far past its expiry the timer callback is running, in jiffies */
+static inline unsigned long lr_timer_lateness(struct timer_list *timer){
+    return time_after(jiffies, timer->expires) ? jiffies - timer->expires : 0;
+}
+
+/*
+ * refer to comments in the hr version of the callback function */
+static void lr_interval_cb(struct timer_list *timer){
+    struct gpio_line_state *gls;
+    unsigned long late, next;
+    u64 overruns, t0 = bench_start();
+    int cycles, prev;
+
+    gls = container_of(timer, struct gpio_line_state, timer.lr);
+
+    if (!gls->pin_ctl_enabled) return;
+
+    late = lr_timer_lateness(timer);
+    latency_record(&gls->latency, jiffies_to_nsecs(late));
+    prev = gls->pin_logic_level;
+
+    if (gls->abs_sched){
+        /* re-arm relative to the deadline that just expired rather than to
+         * the current jiffies value, which drifts by however late the
+         * callback runs */
+        overruns = gls->overruns;
+        next = line_advance(gls, late);
+        if (next) mod_timer(timer, timer->expires + next);
+
+        line_trace_fire(gls, jiffies_to_nsecs(late), 1 + gls->overruns - overruns, prev);
+        line_io_set(gls, gls->pin_logic_level);
+        if (t0) bench_record(&gls->latency, t0, prev != gls->pin_logic_level);
+        return;
+    }
+
+    cycles = line_step(gls);
+
+    if (cycles)
+        mod_timer(timer, jiffies + slots_to_interval(&gls->tb, cycles));
+
+    line_trace_fire(gls, jiffies_to_nsecs(late), 1, prev);
+    line_io_set(gls, gls->pin_logic_level);
+    if (t0) bench_record(&gls->latency, t0, prev != gls->pin_logic_level);
+}
+
+static void lr_group_cb(struct timer_list *timer){
+    struct line_group *grp;
+    unsigned long late;
+    u64 slots = 1, t0 = bench_start();
+
+    grp = container_of(timer, struct line_group, timer.lr);
+    late = lr_timer_lateness(timer);
+
+    if (grp->abs_sched){
+        mod_timer(timer, timer->expires + slot_sched_catch_up(&grp->tb, late, &slots));
+    } else {
+        mod_timer(timer, jiffies + slots_to_interval(&grp->tb, 1));
+    }
+
+    line_group_tick(grp, slots, 0, jiffies_to_nsecs(late), t0);
+}
+
+/* ==== backend-independent timer operations ==== */
+
+static inline enum hrtimer_mode hr_mode(struct line_timer *t, bool abs){
+    return (abs ? HRTIMER_MODE_ABS : HRTIMER_MODE_REL) |
+        (t->cpu >= 0 ? HRTIMER_MODE_PINNED : 0) |
+        (t->backend == BACKEND_HRTIMER_HARD ? HRTIMER_MODE_HARD : HRTIMER_MODE_SOFT);
+}
+
+/*
+ * (Re)initialize the timer for the given backend and CPU (-1 for any); the
+ * timer must not be running. The slack is kept. */
+static void line_timer_init(struct line_timer *t, int backend, int cpu,
+        enum hrtimer_restart (*hr_cb)(struct hrtimer *),
+        void (*lr_cb)(struct timer_list *))
+{
+    t->backend = backend;
+    t->cpu = cpu;
+
+    /* NOTE: the DMA backend gets an (unused) hrtimer, which keeps
+     * line_timer_cancel() harmless */
+    if (backend == BACKEND_LOWRES){
+        /* a pinned timer_list stays on the CPU it is re-armed on, i.e.
+         * that of the callback, once started there with add_timer_on() */
+        timer_setup(&t->lr, lr_cb, cpu >= 0 ? TIMER_PINNED : 0);
+        return;
+    }
+
+    hrtimer_init(&t->hr, CLOCK_MONOTONIC, hr_mode(t, false));
+    t->hr.function = hr_cb;
+}
+
+struct line_timer_start_args {
+    struct line_timer *timer;
+    u64 interval;
+    bool abs;
+    const struct line_epoch *at;
+};
+
+/*
+ * hrtimers are started on the local CPU; see line_timer_start().
+ * NOTE: the slack is the width of the window the timer may expire in, which
+ * lets the hrtimer core fire it along with other timers expiring in the
+ * meantime rather than wake the CPU up just for it. Since the callbacks
+ * re-arm by moving the expiry forward, the window is kept from then on. The
+ * same goes for the latency compensation, learned over previous runs. */
+static void hr_timer_start_local(void *info){
+    struct line_timer_start_args *args = info;
+    struct line_timer *t = args->timer;
+    u64 comp = 0;
+
+    if (t->comp){
+        t->comp_idx = 0;
+        comp = t->comp_ns[0];
+    }
+
+    if (args->at)
+        hrtimer_start_range_ns(&t->hr, ktime_sub_ns(ktime_add_ns(args->at->hr, args->interval), comp),
+                t->slack, hr_mode(t, true));
+    else if (args->abs)
+        hrtimer_start_range_ns(&t->hr, ktime_sub_ns(ktime_add_ns(ktime_get(), args->interval), comp),
+                t->slack, hr_mode(t, true));
+    else
+        hrtimer_start_range_ns(&t->hr, ns_to_ktime(args->interval > comp ? args->interval - comp : 0),
+                t->slack, hr_mode(t, false));
+}
+
+/*
+ * Arm the timer to fire 'interval' timer units from now. If 'abs', the
+ * expiry is an absolute CLOCK_MONOTONIC time with high-res timers, such that
+ * absolute-deadline scheduling can derive all subsequent deadlines from it.
+ * If the timer is pinned, it is started on its CPU, where it stays from then
+ * on since it is only ever re-armed from its own callback.
+ * With an epoch, 'interval' is counted from the epoch rather than from now
+ * (and the expiry always absolute); see start_all_lines(). */
+static void line_timer_start_at(struct line_timer *t, u64 interval, bool abs,
+        const struct line_epoch *at)
+{
+    struct line_timer_start_args args = {.timer = t, .interval = interval, .abs = abs, .at = at};
+    unsigned long base = at ? at->jiffies : jiffies;
+
+    if (t->backend == BACKEND_LOWRES){
+        if (t->cpu < 0 || !cpu_online(t->cpu)){
+            mod_timer(&t->lr, base + interval);
+            return;
+        }
+
+        t->lr.expires = base + interval;
+        add_timer_on(&t->lr, t->cpu);
+        return;
+    }
+
+    if (t->cpu < 0){
+        hr_timer_start_local(&args);
+        return;
+    }
+
+    if (smp_call_function_single(t->cpu, hr_timer_start_local, &args, 1)){
+        message("CPU %d is offline; starting timer on CPU %d instead",
+                t->cpu, raw_smp_processor_id());
+        hr_timer_start_local(&args);
+    }
+}
+
+static inline void line_timer_start(struct line_timer *t, u64 interval, bool abs){
+    line_timer_start_at(t, interval, abs, NULL);
+}
+
+static void line_timer_cancel(struct line_timer *t){
+    if (t->backend == BACKEND_LOWRES){
+        /* NOTE: recent kernels will have renamed this to
+         * timer_delete_sync(). Not so on 5.15 */
+        del_timer_sync(&t->lr);
+        return;
+    }
+
+    hrtimer_cancel(&t->hr);
+}
+
+/*
+ * Make sure the group arrays can hold at least n members. */
+static int line_group_reserve(struct line_group *grp, unsigned int n){
+    struct gpio_desc **descs, **old_descs;
+    unsigned long *values, *old_values, flags;
+    unsigned int capacity = max(grp->capacity * 2, 4U);
+
+    if (n <= grp->capacity) return 0;
+
+    descs = kcalloc(capacity, sizeof(*descs), GFP_KERNEL);
+    values = bitmap_zalloc(capacity, GFP_KERNEL);
+    if (!descs || !values){
+        kfree(descs); bitmap_free(values);
+        return -ENOMEM;
+    }
+
+    raw_spin_lock_irqsave(&grp->lock, flags);
+    if (grp->nmembers) memcpy(descs, grp->descs, grp->nmembers * sizeof(*descs));
+    old_descs = grp->descs; grp->descs = descs;
+    old_values = grp->values; grp->values = values;
+    grp->capacity = capacity;
+    raw_spin_unlock_irqrestore(&grp->lock, flags);
+
+    kfree(old_descs); bitmap_free(old_values);
+    return 0;
+}
+
+static struct line_group *line_group_create(struct gpio_line_state *gls){
+    struct line_group *grp;
+
+    if (!(grp = kzalloc(sizeof(struct line_group), GFP_KERNEL)))
+        return NULL;
+
+    INIT_LIST_HEAD(&grp->members);
+    raw_spin_lock_init(&grp->lock);
+    set_timebase_frequency(&grp->tb, gls->tb.freq, gls->tb.units_per_sec);
+    grp->abs_sched = gls->abs_sched;
+    line_timer_init(&grp->timer, gls->timer.backend, gls->timer.cpu,
+            hr_group_cb, lr_group_cb);
+    grp->timer.slack = gls->timer.slack;
+    grp->timer.comp = gls->timer.comp;
+
+    if (line_group_reserve(grp, 1)){
+        kfree(grp); return NULL;
+    }
+
+    list_add(&grp->list, &groups);
+    return grp;
+}
+
+static void line_group_destroy(struct line_group *grp){
+    list_del(&grp->list);
+    line_timer_cancel(&grp->timer);
+    kfree(grp->descs);
+    bitmap_free(grp->values);
+    kfree(grp);
+}
+
+/*
+ * Whether the members can all be written with a single GPSET and GPCLR
+ * write, or need io_worker to be written; called under the group lock
+ * whenever the members change. */
+static void line_group_update_io(struct line_group *grp){
+    struct gpio_line_state *gls, *first;
+    bool mmio = true;
+
+    grp->mmio = grp->deferred = false;
+    if (!grp->nmembers) return;
+
+    first = list_first_entry(&grp->members, struct gpio_line_state, group_node);
+    list_for_each_entry(gls, &grp->members, group_node){
+        if (gls->io.kind == IO_WORKER) grp->deferred = true;
+        /* NOTE: same bank, same registers; see struct gpio_regs */
+        if (gls->io.kind != IO_MMIO || gls->io.set_reg != first->io.set_reg) mmio = false;
+    }
+
+    if (!mmio) return;
+
+    grp->mmio = true;
+    grp->set_reg = first->io.set_reg;
+    grp->clr_reg = first->io.clr_reg;
+}
+
+/*
+ * Add a slot-driven line to the group for its frequency, creating (and
+ * starting the timer of) the group if there is none yet, at the epoch if
+ * one is given. The line's state machine starts being advanced from the next
+ * tick of the group. */
+static int line_group_join(struct gpio_line_state *gls, const struct line_epoch *at){
+    struct line_group *grp;
+    bool created = false;
+    unsigned long flags;
+    int rc;
+
+    mutex_lock(&groups_lock);
+
+    list_for_each_entry(grp, &groups, list){
+        if (grp->tb.freq == gls->tb.freq && grp->abs_sched == gls->abs_sched
+                && grp->timer.backend == gls->timer.backend
+                && grp->timer.cpu == gls->timer.cpu
+                && grp->timer.slack == gls->timer.slack
+                && grp->timer.comp == gls->timer.comp)
+            goto found;
+    }
+
+    if (!(grp = line_group_create(gls))){
+        mutex_unlock(&groups_lock);
+        return -ENOMEM;
+    }
+    created = true;
+
+found:
+    if ((rc = line_group_reserve(grp, grp->nmembers + 1))){
+        mutex_unlock(&groups_lock);
+        return rc;
+    }
+
+    raw_spin_lock_irqsave(&grp->lock, flags);
+    list_add_tail(&gls->group_node, &grp->members);
+    grp->descs[grp->nmembers++] = gls->gpio_descriptor;
+    gls->group = grp;
+    line_group_update_io(grp);
+    raw_spin_unlock_irqrestore(&grp->lock, flags);
+
+    /* in absolute-deadline mode all subsequent deadlines are derived
+     * from this start time */
+    if (created) line_timer_start_at(&grp->timer, 0, grp->abs_sched, at);
+
+    mutex_unlock(&groups_lock);
+    return 0;
+}
+
+/*
+ * Remove the line from its group, if any; the group is destroyed when its
+ * last member leaves. */
+static void line_group_leave(struct gpio_line_state *gls){
+    struct line_group *grp;
+    struct gpio_line_state *member;
+    unsigned long flags;
+    unsigned int i = 0;
+
+    mutex_lock(&groups_lock);
+
+    if (!(grp = gls->group)){
+        mutex_unlock(&groups_lock);
+        return;
+    }
+
+    raw_spin_lock_irqsave(&grp->lock, flags);
+    list_del(&gls->group_node);
+    gls->group = NULL;
+    grp->nmembers--;
+    list_for_each_entry(member, &grp->members, group_node){
+        grp->descs[i++] = member->gpio_descriptor;
+    }
+    line_group_update_io(grp);
+    raw_spin_unlock_irqrestore(&grp->lock, flags);
+
+    if (grp->nmembers == 0) line_group_destroy(grp);
+
+    mutex_unlock(&groups_lock);
+}
+
+static void line_dma_stop(struct gpio_line_state *gls);
+static void line_pwm_stop(struct gpio_line_state *gls);
+
+/*
+ * Stop pulse generation. A line driven by a timer is left at whatever level
+ * it was at; one in the hands of the DMA backend or the PWM has its pin muxed
+ * back to the gpio function and is driven LOW (see line_dma_stop() and
+ * line_pwm_stop()). Parameters still pending (see struct line_params) are put
+ * into effect right away. */
+static void stop_pulse_train(struct gpio_line_state *gls){
+    line_dma_stop(gls);
+    line_pwm_stop(gls);
+    line_timer_cancel(&gls->timer);
+    line_group_leave(gls);
+    line_params_sync(gls, true);
+
+    /* a ramp under way skips to its end */
+    if (gls->ramp.active){
+        line_ramp_apply(gls, 1 << 16);
+        WRITE_ONCE(gls->ramp.active, false);
+    }
+
+    /* a deferred write must not land after whatever the caller writes, nor
+     * io_worker still walk io_node once the line is released. NOTE: not only
+     * IO_WORKER lines; any member of a deferred group is written by
+     * io_worker (see line_group_tick()) */
+    kthread_flush_work(&io_work);
+}
+
+/* put a newly uploaded pattern into effect, if any; the line must be stopped */
+static int commit_pattern(struct gpio_line_state *gls){
+    struct line_pattern *staging = gls->pattern_staging;
+    unsigned int i;
+
+    if (gls->pattern_staged){
+        if (!gls->pattern && !(gls->pattern = kvzalloc(sizeof(struct line_pattern), GFP_KERNEL))){
+            message("Memory allocation failure");
+            return -ENOMEM;
+        }
+
+        gls->pattern->len = staging->len;
+        gls->pattern->nsteps = 0;
+        gls->pattern->total_slots = 0;
+        memcpy(gls->pattern->entries, staging->entries, staging->len * sizeof(u32));
+
+        for (i = 0; i < staging->len; i++){
+            if (!entry_slots(gls, staging->entries[i])) continue;
+            gls->pattern->nsteps++;
+            gls->pattern->total_slots += entry_slots(gls, staging->entries[i]);
+        }
+
+        gls->pattern_staged = false;
+    }
+
+    return 0;
+}
+
+/*
+ * Put off the start of the waveform until 'phase' time slots past the epoch
+ * (or past now, if there is none) by arming the timer for then with the line
+ * held LOW, for the callback to take the first step: the state machines all
+ * go from LOW to the first level of the waveform. Returns false, for the
+ * caller to take the first step right away, if there is nothing to put off. */
+static bool line_start_phased(struct gpio_line_state *gls, const struct line_epoch *at){
+    if (!gls->phase && !at) return false;
+
+    gls->pin_logic_level = LOGIC_LOW;
+    line_write(gls, LOGIC_LOW);
+    line_timer_start_at(&gls->timer, slots_to_interval(&gls->tb, gls->phase), gls->abs_sched, at);
+    return true;
+}
+
+/*
+ * Start playing the pattern from the beginning, first putting a newly
+ * uploaded pattern into effect, if any. A pattern that is empty (or made up
+ * of zero-duration entries only) or a freq of 0 leaves the line LOW. */
+static void start_pattern(struct gpio_line_state *gls, const struct line_epoch *at){
+    int slots = 0;
+
+    if (commit_pattern(gls)) return;
+
+    gls->tb.phase_acc = 0;
+    gls->pattern_pos = -1;
+    gls->pin_logic_level = LOGIC_LOW;
+
+    if (gls->tb.freq > 0 && gls->pattern && gls->pattern->nsteps > 0){
+        if (line_start_phased(gls, at)) return;
+        slots = pattern_step(gls);
+    }
+
+    line_write(gls, gls->pin_logic_level);
+
+    if (slots)
+        line_timer_start(&gls->timer, slots_to_interval(&gls->tb, slots), gls->abs_sched);
+}
+
+/*
+ * Start playing entries from the ring, carrying on from wherever the
+ * consumer left off. If the ring is empty (or there is no ring yet since the
+ * device was never opened) or freq is 0, the line is left LOW and the stream
+ * stopped, to be kicked off once there is something to play. */
+static void start_stream(struct gpio_line_state *gls, const struct line_epoch *at){
+    int slots = 0;
+
+    gls->tb.phase_acc = 0;
+    gls->pin_logic_level = LOGIC_LOW;
+    atomic_set(&gls->stream_stopped, 1);
+
+    if (gls->tb.freq > 0 && gls->ring){
+        atomic_set(&gls->stream_stopped, 0);
+        WRITE_ONCE(gls->ring->flags, 0);
+        if (line_start_phased(gls, at)) return;
+        slots = stream_step(gls);
+    }
+
+    line_write(gls, gls->pin_logic_level);
+
+    if (slots)
+        line_timer_start(&gls->timer, slots_to_interval(&gls->tb, slots), gls->abs_sched);
+}
+
+/* Start modulating at the brightness set; see pdm_step() */
+static void start_pdm(struct gpio_line_state *gls, const struct line_epoch *at){
+    int slots = 0;
+
+    gls->tb.phase_acc = 0;
+    gls->pdm_acc = PDM_MAX / 2;
+    gls->pin_logic_level = LOGIC_LOW;
+
+    if (gls->tb.freq > 0){
+        if (line_start_phased(gls, at)) return;
+        slots = pdm_step(gls);
+    }
+
+    line_write(gls, gls->pin_logic_level);
+
+    if (slots)
+        line_timer_start(&gls->timer, slots_to_interval(&gls->tb, slots), gls->abs_sched);
+}
+
+/* ==== DMA backend ==== */
+
+/* append n time slots at the given level to the buffer; MSB first */
+static void dma_put_bits(u32 *buf, u64 *pos, int level, u64 n){
+    u32 bit, k, mask;
+
+    while (n){
+        bit = *pos & 31;
+        k = min_t(u64, n, 32 - bit);
+        mask = k == 32 ? ~0U : ((1U << k) - 1) << (32 - bit - k);
+
+        if (level) buf[*pos >> 5] |= mask;
+        else buf[*pos >> 5] &= ~mask;
+
+        *pos += k;
+        n -= k;
+    }
+}
+
+/*
+ * Render the waveform into the DMA buffer: a whole period of it (on_cycles +
+ * off_cycles time slots, or the whole pattern), repeated as many times as it
+ * takes to make up a whole number of words if it is to be played over and
+ * over, which *cyclic is set to tell. A pattern played once is padded with
+ * LOW up to the next word instead. Each time slot takes dma->stretch bits.
+ * Returns the number of words. */
+static int line_dma_render(struct gpio_line_state *gls, bool *cyclic){
+    u32 *buf = gls->dma->buf;
+    u64 period, pos = 0, n = gls->dma->stretch;
+    unsigned int i, reps = 1;
+
+    *cyclic = gls->mode != MODE_PATTERN_ONCE;
+
+    switch (gls->mode){
+    case MODE_PULSE:
+        /* NOTE: there is nothing to count the pulses played with */
+        if (gls->count) return -EOPNOTSUPP;
+        if (gls->on_cycles == 0 || gls->off_cycles == 0){  /* constant level */
+            buf[0] = gls->on_cycles > 0 ? ~0U : 0;
+            return 1;
+        }
+        period = (u64)gls->on_cycles + gls->off_cycles;
+        break;
+
+    case MODE_PATTERN_ONCE:
+    case MODE_PATTERN_LOOP:
+        if (commit_pattern(gls)) return -ENOMEM;
+        if (!gls->pattern || !(period = gls->pattern->total_slots)){
+            buf[0] = 0;
+            *cyclic = true;
+            return 1;
+        }
+        break;
+
+    default:
+        /* NOTE: the stream is produced at the pace it is played at, which
+         * the buffer cannot be rendered ahead of; and PDM waveforms are up
+         * to PDM_MAX time slots long, times 32 to make up whole words */
+        return -EOPNOTSUPP;
+    }
+
+    period *= n;
+    if (*cyclic) reps = 32 / gcd(period & 31, 32);
+    if (period * reps > (u64)DMA_BUF_WORDS * 32 - (*cyclic ? 0 : 32))
+        return -E2BIG;
+
+    while (reps--){
+        if (gls->mode == MODE_PULSE){
+            dma_put_bits(buf, &pos, LOGIC_HIGH, gls->on_cycles * n);
+            dma_put_bits(buf, &pos, LOGIC_LOW, gls->off_cycles * n);
+            continue;
+        }
+
+        for (i = 0; i < gls->pattern->len; i++)
+            dma_put_bits(buf, &pos, PATTERN_LEVEL(gls->pattern->entries[i]),
+                    PATTERN_SLOTS(gls->pattern->entries[i]) * n);
+    }
+
+    if (!*cyclic) dma_put_bits(buf, &pos, LOGIC_LOW, 32 - (pos & 31));
+    return pos >> 5;
+}
+
+/*
+ * Set the PWM clock for the serializer to put out exactly freq time slots per
+ * second. clk_set_rate() settles for whatever rate the divider rounds to,
+ * which with its limited range and resolution can be well off freq. Each time
+ * slot is hence stretched over as few serializer bits as it takes for freq
+ * times that to be a rate the clock does run at. Fails with -ERANGE if there
+ * is none. */
+static int line_dma_set_rate(struct gpio_line_state *gls){
+    struct line_dma *dma = gls->dma;
+    unsigned long rate;
+    unsigned int n;
+    int rc;
+
+    for (n = 1; n <= DMA_MAX_STRETCH && (u64)gls->tb.freq * n <= DMA_MAX_FREQ; n++){
+        rate = (unsigned long)gls->tb.freq * n;
+        if (clk_round_rate(dma->clk, rate) != rate) continue;
+
+        /* NOTE: the rate is whatever the clock reports, not what was asked for */
+        if ((rc = clk_set_rate(dma->clk, rate))) return rc;
+        if (clk_get_rate(dma->clk) != rate) continue;
+
+        dma->stretch = n;
+        return 0;
+    }
+
+    message("%s: the PWM clock cannot run at %u Hz or a multiple of it",
+            gls->devname, gls->tb.freq);
+    return -ERANGE;
+}
+
+/*
+ * Hand the line over to the hardware: render the waveform, start the DMA
+ * feeding the PWM FIFO and mux the pin to the PWM channel. */
+static int line_dma_start(struct gpio_line_state *gls){
+    struct line_dma *dma = gls->dma;
+    struct dma_async_tx_descriptor *desc;
+    unsigned int shift = dma->channel * 8;
+    size_t len;
+    bool cyclic;
+    int words, rc;
+    u32 ctl;
+
+    if ((rc = line_dma_set_rate(gls))) return rc;
+    if ((words = line_dma_render(gls, &cyclic)) < 0) return words;
+    len = words * sizeof(u32);
+
+    if ((rc = clk_prepare_enable(dma->clk))) return rc;
+
+    desc = cyclic ?
+        dmaengine_prep_dma_cyclic(dma->chan, dma->buf_dma, len, len, DMA_MEM_TO_DEV, 0) :
+        dmaengine_prep_slave_single(dma->chan, dma->buf_dma, len, DMA_MEM_TO_DEV, 0);
+    if (!desc){
+        clk_disable_unprepare(dma->clk);
+        return -EIO;
+    }
+
+    /* serializer fed from the FIFO, 32 bits per word; NOTE: POLA
+     * takes care of active-low lines, SBIT keeps them inactive when idle */
+    ctl = PWM_CTL_MODE | PWM_CTL_USEF;
+    if (gpiod_is_active_low(gls->gpio_descriptor)) ctl |= PWM_CTL_POLA | PWM_CTL_SBIT;
+
+    writel(PWM_CTL_CLRF, dma->pwm + PWM_CTL);
+    writel(32, dma->pwm + (dma->channel ? PWM_RNG2 : PWM_RNG1));
+    writel(PWM_DMAC_ENAB | PWM_DMAC_THRESHOLDS, dma->pwm + PWM_DMAC);
+    writel(ctl << shift, dma->pwm + PWM_CTL);
+
+    if (dma_submit_error(dmaengine_submit(desc))){
+        writel(0, dma->pwm + PWM_DMAC);
+        clk_disable_unprepare(dma->clk);
+        return -EIO;
+    }
+    dma_async_issue_pending(dma->chan);
+
+    pinctrl_select_state(dma->pinctrl, dma->pins);
+    writel((ctl | PWM_CTL_PWEN) << shift, dma->pwm + PWM_CTL);
+
+    dma->running = true;
+    return 0;
+}
+
+/* take the line back from the hardware; it is left LOW */
+static void line_dma_stop(struct gpio_line_state *gls){
+    struct line_dma *dma = gls->dma;
+
+    if (!dma || !dma->running) return;
+
+    writel(0, dma->pwm + PWM_CTL);
+    dmaengine_terminate_sync(dma->chan);
+    writel(0, dma->pwm + PWM_DMAC);
+    clk_disable_unprepare(dma->clk);
+
+    /* NOTE: this also muxes the pin back to the gpio function */
+    gls->pin_logic_level = LOGIC_LOW;
+    gpiod_direction_output(gls->gpio_descriptor, LOGIC_LOW);
+
+    dma->running = false;
+}
+
+/* NOTE: copes with partially set up instances; see line_dma_init() */
+static void line_dma_free(struct line_dma *dma){
+    if (!dma) return;
+
+    if (dma->buf)
+        dma_free_coherent(dma->chan->device->dev, DMA_BUF_WORDS * sizeof(u32),
+                dma->buf, dma->buf_dma);
+    if (dma->chan) dma_release_channel(dma->chan);
+    if (dma->pinctrl) pinctrl_put(dma->pinctrl);
+    if (!IS_ERR_OR_NULL(dma->clk)) clk_put(dma->clk);
+    if (dma->pwm) iounmap(dma->pwm);
+    kfree(dma);
+}
+
+/* ==== hardware PWM offload ==== */
+
+/*
+ * If the line has a PWM channel (the 'pwms' DT property), pulse trains are
+ * generated by it rather than by a timer: on_cycles + off_cycles time slots
+ * make up the PWM period and on_cycles the duty cycle. The timer backends
+ * remain the fallback for anything the PWM cannot do (pattern modes and
+ * settings the PWM controller rejects). */
+static int line_pwm_start(struct gpio_line_state *gls){
+    struct pwm_state state;
+    u64 slots = (u64)gls->on_cycles + gls->off_cycles;
+    int rc;
+
+    pwm_init_state(gls->pwm, &state);
+    state.period = div64_u64(slots * NSEC_PER_SEC, gls->tb.freq);
+    state.duty_cycle = div64_u64((u64)gls->on_cycles * NSEC_PER_SEC, gls->tb.freq);
+    state.polarity = gpiod_is_active_low(gls->gpio_descriptor) ?
+        PWM_POLARITY_INVERSED : PWM_POLARITY_NORMAL;
+    state.enabled = true;
+
+    if (!state.period) return -ERANGE;
+    if ((rc = pwm_apply_state(gls->pwm, &state))) return rc;
+
+    if (gls->pwm_pins) pinctrl_select_state(gls->pwm_pinctrl, gls->pwm_pins);
+    gls->pwm_on = true;
+    return 0;
+}
+
+/* take the line back from the PWM; it is left LOW */
+static void line_pwm_stop(struct gpio_line_state *gls){
+    if (!gls->pwm_on) return;
+
+    pwm_disable(gls->pwm);
+
+    /* NOTE: this also muxes the pin back to the gpio function */
+    gls->pin_logic_level = LOGIC_LOW;
+    gpiod_direction_output(gls->gpio_descriptor, LOGIC_LOW);
+
+    gls->pwm_on = false;
+}
+
+/*
+ * (Re)start pulse generation from the beginning of the on_cycles state (or
+ * of the pattern), against the given epoch, if any (see start_all_lines());
+ * only meaningful when status=1.
+ *
+ * In slot-driven mode the line joins the group of lines running at the same
+ * frequency and is advanced once per time slot by the group timer. In
+ * edge-driven mode the line's own timer is only armed for the end of the
+ * on_cycles stretch -- or not at all if on_cycles or off_cycles is 0, in which
+ * case the line is simply held at the corresponding constant level.
+ * NOTE: if freq is 0, there are no pulses and hence no timer. Only a stable
+ * LOGIC_HIGH state. The DMA and PWM offloads start right away regardless of
+ * the epoch. */
+static void start_pulse_train_at(struct gpio_line_state *gls, const struct line_epoch *at){
+    int cycles = 1, rc;
+
+    stop_pulse_train(gls);
+    gls->pulses = 0;
+    WRITE_ONCE(gls->done, 0);
+
+    /* played by the hardware from here on; nothing for the CPU to do */
+    if (gls->timer.backend == BACKEND_DMA && gls->tb.freq > 0){
+        if ((rc = line_dma_start(gls)))
+            message("Failed to start DMA waveform for %s (%d)", gls->devname, rc);
+        return;
+    }
+
+    /* generated by the PWM from here on, if it can */
+    if (gls->pwm && gls->mode == MODE_PULSE && gls->tb.freq > 0 && !gls->count){
+        if (!(rc = line_pwm_start(gls))) return;
+        message("%s: PWM cannot be set up for this (%d); using the timer instead",
+                gls->devname, rc);
+    }
+
+    if (gls->mode == MODE_STREAM){
+        start_stream(gls, at);
+        return;
+    }
+
+    if (gls->mode == MODE_PDM){
+        start_pdm(gls, at);
+        return;
+    }
+
+    if (gls->mode != MODE_PULSE){
+        start_pattern(gls, at);
+        return;
+    }
+
+    gls->counter = 0;
+    gls->tb.phase_acc = 0;
+    gls->pin_logic_level = LOGIC_HIGH;
+
+    if (gls->edge_sched){
+        if (gls->on_cycles == 0 || gls->off_cycles == 0){
+            gls->pin_logic_level = gls->on_cycles > 0 ? LOGIC_HIGH : LOGIC_LOW;
+            cycles = 0;
+        }
+        else cycles = gls->on_cycles;
+    }
+
+    /* no pulses: stable HIGH regardless of the cycle settings */
+    if (gls->tb.freq == 0) gls->pin_logic_level = LOGIC_HIGH;
+
+    /* NOTE: slot-driven lines tick along with their group, which an epoch
+     * starts; their phase is where in the period they start from instead */
+    if (gls->tb.freq > 0 && cycles > 0 && gls->edge_sched && line_start_phased(gls, at))
+        return;
+    if (gls->tb.freq > 0 && !gls->edge_sched) slot_sched_phase(gls);
+
+    line_write(gls, gls->pin_logic_level);
+
+    if (gls->tb.freq == 0 || cycles == 0) return;
+
+    if (!gls->edge_sched){
+        if (line_group_join(gls, at))
+            message("Failed to start pulse generation for %s", gls->devname);
+        return;
+    }
+
+    /* in absolute-deadline mode all subsequent deadlines are derived from
+     * this start time */
+    line_timer_start(&gls->timer, slots_to_interval(&gls->tb, cycles), gls->abs_sched);
+}
+
+static inline void start_pulse_train(struct gpio_line_state *gls){
+    start_pulse_train_at(gls, NULL);
+}
+
+/* an epoch far enough ahead of now for the lines to be armed before it */
+static inline void line_epoch_ahead(struct line_epoch *epoch){
+    epoch->hr = ktime_add_us(ktime_get(), START_LEAD_US);
+    epoch->jiffies = jiffies + usecs_to_jiffies(START_LEAD_US);
+}
+
+/*
+ * Restart all the lines with status=1 against a common epoch a little
+ * ahead of now, such that lines with the same freq are in phase -- or rather
+ * apart by their 'phase' settings, which also keeps their edges from all
+ * coming at the same instant. All are stopped first so that no line is left
+ * running off a group started before the epoch.
+ * NOTE: cfg_lock is not held across the two passes, which would take as
+ * many locks as there are lines; the lines are marked start_pending instead,
+ * for writes that would start them before the epoch to be refused. */
+static void start_all_lines(void){
+    struct gpio_line_state *gls;
+    struct line_epoch epoch;
+    unsigned long id;
+
+    mutex_lock(&lines_lock);
+
+    xa_for_each(&lines, id, gls){
+        mutex_lock(&gls->cfg_lock);
+        stop_pulse_train(gls);
+        gls->start_pending = true;
+        mutex_unlock(&gls->cfg_lock);
+    }
+
+    line_epoch_ahead(&epoch);
+
+    xa_for_each(&lines, id, gls){
+        mutex_lock(&gls->cfg_lock);
+        gls->start_pending = false;
+        if (gls->pin_ctl_enabled) start_pulse_train_at(gls, &epoch);
+        mutex_unlock(&gls->cfg_lock);
+    }
+
+    mutex_unlock(&lines_lock);
+}
+
+/* ==== input capture ==== */
+
+static inline u32 capture_pending(struct line_capture *cap){
+    return smp_load_acquire(&cap->head) - READ_ONCE(cap->tail);
+}
+
+/*
+ * Timestamp the edge and put it in the ring; see struct line_capture.
+ * NOTE: IRQF_NO_THREAD keeps this in hard irq context on PREEMPT_RT as well,
+ * where the timestamps would otherwise be taken whenever the irq thread got
+ * to run. Readers are woken up through ring_work, only as the number of
+ * events pending reaches the batch size rather than for every edge. */
+static irqreturn_t capture_irq(int irq, void *data){
+    struct gpio_line_state *gls = data;
+    struct line_capture *cap = gls->cap;
+    u64 now = ktime_get_ns();
+    int level = gpiod_get_value(gls->gpio_descriptor);
+    u32 head = cap->head, used;
+    struct gpioman_event *ev;
+
+    if (level > 0){
+        if (cap->last_rise) WRITE_ONCE(cap->period_ns, now - cap->last_rise);
+        cap->last_rise = now;
+    }
+    else if (level == 0 && cap->last_rise){
+        WRITE_ONCE(cap->high_ns, now - cap->last_rise);
+        cap->last_fall = now;
+    }
+
+    /* pairs with the release of tail in chardev_read() */
+    used = head - smp_load_acquire(&cap->tail);
+    if (used >= CAPTURE_RING_EVENTS){
+        WRITE_ONCE(gls->overruns, gls->overruns + 1);
+        return IRQ_HANDLED;
+    }
+
+    ev = &cap->events[head % CAPTURE_RING_EVENTS];
+    ev->timestamp_ns = now;
+    ev->level = level;
+    smp_store_release(&cap->head, head + 1);
+
+    if (used + 1 == max(READ_ONCE(cap->batch), 1U))
+        irq_work_queue(&gls->ring_work);
+
+    return IRQ_HANDLED;
+}
+
+/*
+ * The frequency (Hz) or, if 'duty', the duty cycle (per mille) of the signal
+ * as of its last period; 0 if it has not had an edge for two periods or more. */
+static int capture_measure(struct gpio_line_state *gls, bool duty){
+    struct line_capture *cap = gls->cap;
+    u64 period, high, last;
+
+    if (!cap) return 0;
+
+    period = READ_ONCE(cap->period_ns);
+    high = READ_ONCE(cap->high_ns);
+    last = max(READ_ONCE(cap->last_rise), READ_ONCE(cap->last_fall));
+    if (!period || ktime_get_ns() - last > 2 * period) return 0;
+
+    if (duty) return div64_u64(min(high, period) * 1000, period);
+    return div64_u64(NSEC_PER_SEC + period / 2, period);
+}
+
+/* sysfs writes to input lines: capture_batch, nothing else */
+static int write_capture_batch(struct gpio_line_state *gls, const char *attribute, int var){
+    if (!gls->cap || !match(attribute, "capture_batch")){
+        message("Invalid sysfs write: %s %s", gls->devname,
+                gls->cap ? "is an input" : "is not an input");
+        return -EPERM;
+    }
+
+    if (var < 1 || var > CAPTURE_RING_EVENTS){
+        message("Invalid sysfs write: capture_batch must be in [1, %d]", CAPTURE_RING_EVENTS);
+        return -EINVAL;
+    }
+
+    WRITE_ONCE(gls->cap->batch, var);
+    wake_up_interruptible(&gls->ring_wait);  /* to check against the new batch size */
+    return 0;
+}
+
+/*
+ * Set up input capture for the line, which must have been requested as an
+ * input: both edges, on the gpio's interrupt. */
+static int line_capture_start(struct gpio_line_state *gls){
+    struct line_capture *cap = gls->cap;
+    int rc;
+
+    /* NOTE: the level is read from the hard irq handler */
+    if (gpiod_cansleep(gls->gpio_descriptor)){
+        message("%s: input capture is not supported on gpios that can sleep", gls->devname);
+        return -EINVAL;
+    }
+
+    if ((cap->irq = gpiod_to_irq(gls->gpio_descriptor)) < 0){
+        message("%s: gpio has no interrupt (%d)", gls->devname, cap->irq);
+        return cap->irq;
+    }
+
+    rc = request_irq(cap->irq, capture_irq,
+            IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING | IRQF_NO_THREAD,
+            gls->devname, gls);
+    if (rc){
+        message("%s: failed to request irq %d (%d)", gls->devname, cap->irq, rc);
+        cap->irq = -1;
+    }
+
+    return rc;
+}
+
+/* =================================================
+ * ==== Generic sysfs operation callbacks ==========
+ * =================================================
+ * - these are called for the default attributes created
+ *   in sysfs by this module, for each device (gpio line)
+ *   managed.
+ * -----------------------------------------------*/
+
+/* called when user reads sysfs attribute */
+static ssize_t read_sysfs_attribute(
+        struct kobject *kobj,
+        struct kobj_attribute *kattr,
+        char *buf)
+{
+	int var;
+    const char *attribute = kattr->attr.name;
+    struct gpio_line_state *gls = container_of(kobj, struct gpio_line_state, kobj);
+    struct line_params p;
+
+    debug("called read_sysfs_attribute");
+
+    /* NOTE: lockless; see struct line_params */
+    if (match(attribute, "overruns"))
+        return sprintf(buf, "%lu\n", READ_ONCE(gls->overruns));
+
+    line_params_read(gls, &p);
+
+    if (match(attribute, "status"))           var = READ_ONCE(gls->pin_ctl_enabled);
+    else if (match(attribute, "on_cycles"))   var = p.on_cycles;
+    else if (match(attribute, "off_cycles"))  var = p.off_cycles;
+    else if (match(attribute, "edge_sched"))  var = READ_ONCE(gls->edge_sched);
+    else if (match(attribute, "abs_sched"))   var = READ_ONCE(gls->abs_sched);
+    else if (match(attribute, "backend"))     var = READ_ONCE(gls->timer.backend);
+    else if (match(attribute, "cpu"))         var = READ_ONCE(gls->timer.cpu);
+    else if (match(attribute, "mode"))        var = READ_ONCE(gls->mode);
+    else if (match(attribute, "phase"))       var = READ_ONCE(gls->phase);
+    else if (match(attribute, "count"))       var = READ_ONCE(gls->count);
+    else if (match(attribute, "done"))        var = READ_ONCE(gls->done);
+    else if (match(attribute, "brightness"))  var = READ_ONCE(gls->brightness);
+    else if (match(attribute, "id"))          var = gls->id;
+    else if (match(attribute, "slack_us"))    var = div_u64(READ_ONCE(gls->timer.slack), NSEC_PER_USEC);
+    else if (match(attribute, "compensate"))  var = READ_ONCE(gls->timer.comp);
+    else if (match(attribute, "capture_batch"))
+        var = gls->cap ? READ_ONCE(gls->cap->batch) : 0;
+    else if (match(attribute, "measured_freq")) var = capture_measure(gls, false);
+    else if (match(attribute, "measured_duty")) var = capture_measure(gls, true);
+
+    else if (match(attribute, "freq"))        var = p.freq;
+
+	return sprintf(buf, "%d\n", var);  /* NOTE: cpu may be -1 */
+}
+
+/*
+ * The time slot duration (1/freq) is kept in nanoseconds when using high-res
+ * timers and in jiffies when using low-res timers (as per the line's
+ * backend), since the resolution of the latter is at best that of the
+ * jiffy. In either case the remainder of the division is carried along such
+ * that the average slot duration is exact; see slots_to_interval().
+ * Specifically, if the kernel HZ variable is e.g 250 then it's pointless
+ * for the user to set a higher value than that for the frequency in sysfs.
+ * The callback will not be invoked more than HZ times a second.
+ *
+ * NOTE: the HZ is a compile-time constant set in kconfig. It can be checked
+ * at the command line like this:
+ *    cat /boot/config-$(uname -r) | grep -i 'HZ='
+ * -- assuming the kernel .config is stored there for the platform.
+ */
+static int clamp_gls_frequency(struct gpio_line_state *gls, int freq){
+    if (gls->timer.backend == BACKEND_DMA){
+        if (freq > DMA_MAX_FREQ){
+            message("Frequency setting cannot be met; defaulting to %u", DMA_MAX_FREQ);
+            freq = DMA_MAX_FREQ;
+        }
+    }
+    else if (gls->timer.backend != BACKEND_LOWRES){
+        /* user should use common sense: the kernel will certainly not be
+        * calling the callback every microsecond, let alone every nanosecond,
+        * especially on a busy system! */
+        if (freq > NSEC_PER_SEC){
+            message("Frequency setting cannot be met; defaulting to %ld",
+                    NSEC_PER_SEC);
+            freq = NSEC_PER_SEC;
+        }
+    }
+    else {
+        /* use the jiffy if user has specified a higher freq than that since
+         * you cannot get a more granular resolution than the jiffy */
+        if (freq > KERNEL_HERTZ){
+            message("Frequency setting cannot be met; defaulting to HZ (%u)",
+                    KERNEL_HERTZ);
+            freq = KERNEL_HERTZ;
+        }
+    }
+
+    return freq;
+}
+
+void set_gls_frequency(struct gpio_line_state *gls, int freq){
+    /* the callback must not see the timebase change under it */
+    stop_pulse_train(gls);
+
+    freq = clamp_gls_frequency(gls, freq);
+    set_timebase_frequency(&gls->tb, freq, backend_units_per_sec(gls->timer.backend));
+    line_params_publish(gls, freq, gls->params.on_cycles, gls->params.off_cycles, false);
+    line_params_sync(gls, true);
+
+    /* if freq>0 and status=1, start timer in case it was disabled;
+     * else if freq=0, no timer needed so cancel in case it's running. */
+    if (gls->pin_ctl_enabled) start_pulse_train(gls);
+}
+
+/*
+ * Switch the line over to a different timer backend and/or CPU (-1 for any).
+ * The timebase is in the units of the backend, so the freq is set again (and
+ * so capped at what the new backend can do), which also restarts the pulse
+ * train -- on the new CPU -- if status=1. */
+static void set_gls_timer(struct gpio_line_state *gls, int backend, int cpu){
+    stop_pulse_train(gls);  /* timer must be idle to be reinitialized */
+    line_timer_init(&gls->timer, backend, cpu, hr_interval_cb, lr_interval_cb);
+    set_gls_frequency(gls, gls->params.freq);
+}
+
+static void set_gls_status(struct gpio_line_state *gls, int status){
+    switch(status){
+
+    case LOGIC_LOW: /* essentially disabled; stop timer and set to low */
+        stop_pulse_train(gls);
+        gls->pin_ctl_enabled = false;
+        gls->pin_logic_level = LOGIC_LOW;
+        line_write(gls, LOGIC_LOW);
+        break;
+
+    case LOGIC_HIGH:
+        /* NOTE: enable first, otherwise a timer firing right away
+         * would see status=0 and not rearm itself */
+        gls->pin_ctl_enabled = true;
+
+        /* restart timer in case it was disabled */
+        start_pulse_train(gls);
+        break;
+    }
+}
+
+/* called when user writes to sysfs attribute */
+static ssize_t write_sysfs_attribute(
+        struct kobject *kobj,
+        struct kobj_attribute *kattr,
+        const char *buf, size_t count)
+{
+	int var, rc;
+    struct gpio_line_state *gls;
+    const char *attribute = kattr->attr.name;
+	rc = kstrtoint(buf, 10, &var);
+
+    debug("called write_sysfs_attribute");
+
+    /* NOTE: cpu=-1 means 'any CPU'; no other attribute takes a negative
+     * value, so nothing below needs to check for one */
+	if (rc < 0 || (var < 0 && !(match(attribute, "cpu") && var == -1))){
+        message("Invalid sysfs write: value must be positive integer");
+        return EINVAL;
+    }
+
+    gls = container_of(kobj, struct gpio_line_state, kobj);
+    trace_gpioman_config(gls->devname, attribute, var);
+
+    /* NOTE: input lines have nothing else to configure */
+    if (match(attribute, "capture_batch") || gls->cap)
+        return write_capture_batch(gls, attribute, var) ?: count;
+
+    /*
+     * NOTE: the timer callback may be running on another CPU. Hence, other
+     * than for the cycle settings of a running slot-driven line (which are
+     * updated under the group lock), the pulse train is always stopped
+     * before anything is changed -- which waits for a running callback to
+     * complete -- and restarted afterwards. */
+    mutex_lock(&gls->cfg_lock);
+    rc = count;
+
+    if (gls->start_pending){
+        message("%s: being restarted against a common start time", gls->devname);
+        rc = -EBUSY;
+    }
+
+	else if (match(attribute, "status")){
+        set_gls_status(gls, var);
+    }
+
+    else if (match(attribute, "freq")){
+        set_gls_frequency(gls, var);
+    }
+    else if (match(attribute, "backend")){
+        if (var >= NUM_BACKENDS){
+            message("Invalid sysfs write: unknown timer backend %d", var);
+            rc = -EINVAL;
+        }
+        else if (var == BACKEND_DMA && !gls->dma){
+            message("%s: no DMA engine for this line; see vcstech,dma-pwm", gls->devname);
+            rc = -ENODEV;
+        }
+        else set_gls_timer(gls, var, gls->timer.cpu);
+    }
+    else if (match(attribute, "cpu")){
+        if (var >= 0 && (var >= nr_cpu_ids || !cpu_online(var))){
+            message("Invalid sysfs write: CPU %d is not online", var);
+            rc = -EINVAL;
+        }
+        else set_gls_timer(gls, gls->timer.backend, var);
+    }
+    else if (match(attribute, "mode") && var >= NUM_MODES){
+        message("Invalid sysfs write: unknown mode %d", var);
+        rc = -EINVAL;
+    }
+    else if (match(attribute, "slack_us") && var > SLACK_MAX_US){
+        message("Invalid sysfs write: slack_us must be in [0, %ld]", SLACK_MAX_US);
+        rc = -EINVAL;
+    }
+    else if (match(attribute, "brightness") && var > PDM_MAX){
+        message("Invalid sysfs write: brightness must be in [0, %d]", PDM_MAX);
+        rc = -EINVAL;
+    }
+
+    /* picked up by the callback at the next transition, unless there is no
+     * callback to pick it up: stopped at a constant level */
+    else if (match(attribute, "brightness") && !(gls->mode == MODE_PDM &&
+                (gls->brightness == 0 || gls->brightness == PDM_MAX))){
+        WRITE_ONCE(gls->brightness, var);
+    }
+    else if (match(attribute, "mode") && (var == MODE_PULSE || var == MODE_PDM) && gls->port){
+        message("Invalid sysfs write: %s is a parallel port; use a pattern or a stream",
+                gls->devname);
+        rc = -EINVAL;
+    }
+
+    /* slot-driven and running: the callback picks the change up at the
+     * next time slot and restarts the state machine; NOTE: always start in
+     * the on_cycles state */
+    else if ((match(attribute, "on_cycles") || match(attribute, "off_cycles"))
+            && gls->group){
+        line_params_publish(gls, gls->params.freq,
+                match(attribute, "on_cycles") ? var : gls->params.on_cycles,
+                match(attribute, "off_cycles") ? var : gls->params.off_cycles,
+                false);
+    }
+
+    /* In edge-driven mode the timer is armed for a point in time derived
+     * from the old cycle settings (or not armed at all if the waveform was
+     * constant), so the pulse train must be restarted for changes to apply.
+     * Same when switching between modes. */
+    else {
+        stop_pulse_train(gls);
+
+        if (match(attribute, "on_cycles") || match(attribute, "off_cycles")){
+            line_params_publish(gls, gls->params.freq,
+                    match(attribute, "on_cycles") ? var : gls->params.on_cycles,
+                    match(attribute, "off_cycles") ? var : gls->params.off_cycles,
+                    false);
+            line_params_sync(gls, true);
+        }
+        else if (match(attribute, "edge_sched"))  gls->edge_sched = !!var;
+        else if (match(attribute, "abs_sched"))   gls->abs_sched = !!var;
+        else if (match(attribute, "mode"))        gls->mode = var;
+        else if (match(attribute, "phase"))       gls->phase = var;
+        else if (match(attribute, "count"))       gls->count = var;
+        else if (match(attribute, "brightness"))  WRITE_ONCE(gls->brightness, var);
+        else if (match(attribute, "slack_us"))    WRITE_ONCE(gls->timer.slack, (u64)var * NSEC_PER_USEC);
+        else if (match(attribute, "compensate"))  WRITE_ONCE(gls->timer.comp, !!var);
+
+        if (gls->pin_ctl_enabled) start_pulse_train(gls);
+    }
+
+    mutex_unlock(&gls->cfg_lock);
+
+    /* used whole buffer; see
+     * https://www.kernel.org/doc/html/next/filesystems/sysfs.html fmi */
+	return rc;
+}
+
+static ssize_t read_sysfs_config(struct kobject *kobj,
+        struct kobj_attribute *kattr, char *buf)
+{
+    struct gpio_line_state *gls = container_of(kobj, struct gpio_line_state, kobj);
+    struct line_params p;
+
+    line_params_read(gls, &p);
+    return sprintf(buf, "%u %d %d %d\n", p.freq, p.on_cycles, p.off_cycles,
+            READ_ONCE(gls->pin_ctl_enabled));
+}
+
+/*
+ * Put the settings of a 'config' write into effect, along with a new phase
+ * unless 'phase' is -1; see write_sysfs_config(). A new phase only takes
+ * effect on a restart, which is hence forced. */
+static int line_apply_config(struct gpio_line_state *gls, int freq, int on, int off,
+        int status, int phase)
+{
+    bool handover;
+
+    trace_gpioman_config(gls->devname, "freq", freq);
+    trace_gpioman_config(gls->devname, "on_cycles", on);
+    trace_gpioman_config(gls->devname, "off_cycles", off);
+    trace_gpioman_config(gls->devname, "status", status);
+
+    mutex_lock(&gls->cfg_lock);
+
+    /* see start_all_lines() */
+    if (gls->start_pending){
+        mutex_unlock(&gls->cfg_lock);
+        return -EBUSY;
+    }
+
+    freq = clamp_gls_frequency(gls, freq);
+
+    /* Only if nothing is pending: the callback may be about to put pending
+     * parameters into effect that stop the timer (edge-driven, on_cycles or
+     * off_cycles 0), in which case the new ones would never be. Otherwise the
+     * settings in effect do not change under us and tell whether the timer
+     * is armed. Not once the count is reached either: the line then sits
+     * out the end of its pulse train, and is restarted instead. */
+    handover = gls->pin_ctl_enabled && status == LOGIC_HIGH && freq > 0 &&
+        !READ_ONCE(gls->done) &&
+        gls->mode == MODE_PULSE && gls->timer.backend != BACKEND_DMA && !gls->pwm_on &&
+        READ_ONCE(gls->params_seen) == gls->params.gen &&
+        (gls->group ? (u32)freq == gls->tb.freq :
+         gls->edge_sched && gls->tb.freq > 0 &&
+         READ_ONCE(gls->on_cycles) > 0 && READ_ONCE(gls->off_cycles) > 0);
+
+    if (phase >= 0 && phase != gls->phase) handover = false;
+
+    if (handover){
+        line_params_publish(gls, freq, on, off, true);
+    }
+    else {
+        stop_pulse_train(gls);
+        if (phase >= 0) gls->phase = phase;
+        set_timebase_frequency(&gls->tb, freq, backend_units_per_sec(gls->timer.backend));
+        line_params_publish(gls, freq, on, off, false);
+        line_params_sync(gls, true);
+        set_gls_status(gls, status);
+    }
+
+    mutex_unlock(&gls->cfg_lock);
+    return 0;
+}
+
+/*
+ * 'config' attribute: "freq on_cycles off_cycles status", in one write.
+ * If the pulse train is running and is to keep running (at the same freq, if
+ * slot-driven), the new settings are handed over to the timer callback to be
+ * applied at the next composite-period boundary; see struct line_params.
+ * Otherwise they are all applied right away, with a single restart. */
+static ssize_t write_sysfs_config(struct kobject *kobj,
+        struct kobj_attribute *kattr, const char *buf, size_t count)
+{
+    struct gpio_line_state *gls = container_of(kobj, struct gpio_line_state, kobj);
+    int freq, on, off, status;
+
+    if (sscanf(buf, "%d %d %d %d", &freq, &on, &off, &status) != 4
+            || freq < 0 || on < 0 || off < 0 || status < 0 || status > 1){
+        message("Invalid sysfs write: expected 'freq on_cycles off_cycles status'");
+        return -EINVAL;
+    }
+
+    if (gls->cap){
+        message("Invalid sysfs write: %s is an input", gls->devname);
+        return -EPERM;
+    }
+
+    return line_apply_config(gls, freq, on, off, status, -1) ?: count;
+}
+
+static ssize_t read_sysfs_ramp(struct kobject *kobj,
+        struct kobj_attribute *kattr, char *buf)
+{
+    struct gpio_line_state *gls = container_of(kobj, struct gpio_line_state, kobj);
+
+    return sprintf(buf, "%d\n", READ_ONCE(gls->ramp.active));
+}
+
+/*
+ * 'ramp' attribute: "freq on_cycles off_cycles duration_ms curve"; fade from
+ * the settings in effect to the given ones. Handed over to the timer callback
+ * like 'config' writes are, and then ramped to over duration_ms; see struct
+ * line_ramp. An edge-driven line at a constant level has no timer running to
+ * ramp with, so it is restarted at the nearest non-constant settings first.
+ * Where there can be no handover at all (stopped, other freq if slot-driven,
+ * pattern modes, PWM or DMA), the settings are applied right away. */
+static ssize_t write_sysfs_ramp(struct kobject *kobj,
+        struct kobj_attribute *kattr, const char *buf, size_t count)
+{
+    struct gpio_line_state *gls = container_of(kobj, struct gpio_line_state, kobj);
+    int freq, on, off, duration, curve;
+    bool running;
+
+    if (sscanf(buf, "%d %d %d %d %d", &freq, &on, &off, &duration, &curve) != 5
+            || freq < 0 || on < 0 || off < 0 || duration < 0 || duration > RAMP_MAX_MS
+            || curve < 0 || curve >= NUM_RAMP_CURVES){
+        message("Invalid sysfs write: expected 'freq on_cycles off_cycles duration_ms curve'");
+        return -EINVAL;
+    }
+
+    if (gls->cap){
+        message("Invalid sysfs write: %s is an input", gls->devname);
+        return -EPERM;
+    }
+
+    trace_gpioman_config(gls->devname, "ramp", duration);
+
+    mutex_lock(&gls->cfg_lock);
+
+    /* see start_all_lines() */
+    if (gls->start_pending){
+        mutex_unlock(&gls->cfg_lock);
+        return -EBUSY;
+    }
+
+    freq = clamp_gls_frequency(gls, freq);
+
+    /* see line_apply_config() */
+    running = gls->pin_ctl_enabled && freq > 0 && duration > 0 && !READ_ONCE(gls->done) &&
+        gls->mode == MODE_PULSE && gls->timer.backend != BACKEND_DMA && !gls->pwm_on &&
+        READ_ONCE(gls->params_seen) == gls->params.gen &&
+        (gls->group ? (u32)freq == gls->tb.freq : gls->edge_sched && gls->tb.freq > 0);
+
+    if (running){
+        if (!gls->group && (gls->on_cycles == 0 || gls->off_cycles == 0)){
+            stop_pulse_train(gls);
+            line_params_publish(gls, gls->tb.freq, max(gls->on_cycles, 1),
+                    max(gls->off_cycles, 1), false);
+            line_params_sync(gls, true);
+            start_pulse_train(gls);
+        }
+        line_params_publish_ramp(gls, freq, on, off, true, duration, curve);
+    }
+    else {
+        stop_pulse_train(gls);
+        set_timebase_frequency(&gls->tb, freq, backend_units_per_sec(gls->timer.backend));
+        line_params_publish(gls, freq, on, off, false);
+        line_params_sync(gls, true);
+        if (gls->pin_ctl_enabled) start_pulse_train(gls);
+    }
+
+    mutex_unlock(&gls->cfg_lock);
+    return count;
+}
+
+/*
+ * 'pattern' binary attribute: the raw array of u32 pattern entries (see
+ * struct line_pattern), in native byte order. A write at offset 0 starts a
+ * new pattern; larger patterns may take several writes (sysfs splits them up
+ * by page anyway). Takes effect the next time the pulse train is started,
+ * e.g. by writing 1 to 'status'. */
+static ssize_t write_sysfs_pattern(struct file *file, struct kobject *kobj,
+        struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+{
+    struct gpio_line_state *gls = container_of(kobj, struct gpio_line_state, kobj);
+    struct line_pattern *staging;
+
+    if (off % sizeof(u32) || count % sizeof(u32)){
+        message("Invalid pattern write: must be made up of whole u32 entries");
+        return -EINVAL;
+    }
+
+    mutex_lock(&gls->cfg_lock);
+
+    if (!gls->pattern_staging &&
+            !(gls->pattern_staging = kvzalloc(sizeof(struct line_pattern), GFP_KERNEL))){
+        mutex_unlock(&gls->cfg_lock);
+        return -ENOMEM;
+    }
+
+    staging = gls->pattern_staging;
+    if (off == 0) staging->len = 0;
+
+    memcpy((char *)staging->entries + off, buf, count);
+    staging->len = max_t(unsigned int, staging->len, (off + count) / sizeof(u32));
+    gls->pattern_staged = true;
+
+    mutex_unlock(&gls->cfg_lock);
+    return count;
+}
+
+static ssize_t read_sysfs_pattern(struct file *file, struct kobject *kobj,
+        struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+{
+    struct gpio_line_state *gls = container_of(kobj, struct gpio_line_state, kobj);
+    size_t len;
+
+    mutex_lock(&gls->cfg_lock);
+
+    len = gls->pattern_staging ? gls->pattern_staging->len * sizeof(u32) : 0;
+    if (off >= len) count = 0;
+    else {
+        count = min_t(size_t, count, len - off);
+        memcpy(buf, (char *)gls->pattern_staging->entries + off, count);
+    }
+
+    mutex_unlock(&gls->cfg_lock);
+    return count;
+}
+
+/* NOTE: sysfs enforces the size limit on writes */
+static BIN_ATTR(pattern, 0664, read_sysfs_pattern, write_sysfs_pattern,
+        PATTERN_MAX_ENTRIES * sizeof(u32));
+
+/*
+ * Give the line its sysfs directory, if it does not have it yet. Lines of DT
+ * nodes with vcstech,lazy-sysfs only get it once asked for, through the
+ * 'export' driver attribute or by opening their character device; until
+ * then they can still be configured with GPIOMAN_IOC_CONFIG. */
+static int line_export(struct gpio_line_state *gls){
+    int rc = 0;
+
+    mutex_lock(&gls->cfg_lock);
+    if (gls->exported) goto out;
+
+    /* nest entries under the driver directory */
+    if ((rc = kobject_add(&gls->kobj, driver_sysfs_entry, "%s", gls->devname))){
+        message("Failed to add kobject (%d) for %s", rc, gls->devname);
+        goto out;
+    }
+
+    /* NOTE: binary attributes cannot be default attributes */
+    if ((rc = sysfs_create_bin_file(&gls->kobj, &bin_attr_pattern))){
+        message("Failed to create pattern attribute (%d) for %s", rc, gls->devname);
+        kobject_del(&gls->kobj);
+        goto out;
+    }
+
+    gls->exported = true;
+
+out:
+    mutex_unlock(&gls->cfg_lock);
+    return rc;
+}
+
+/* =================================================
+ * ==== Character devices ==========================
+ * =================================================
+ * - /dev/gpioman/<devname>, one for each device (gpio
+ *   line) managed, for streaming; see gpioman_uapi.h
+ * -----------------------------------------------*/
+
+/*
+ * See line_done(). A slot-driven line that is done is still in its group,
+ * held LOW; it is taken out here, unless it has been restarted meanwhile. */
+static void done_work_func(struct work_struct *work){
+    struct gpio_line_state *gls = container_of(work, struct gpio_line_state, done_work);
+
+    mutex_lock(&gls->cfg_lock);
+    if (READ_ONCE(gls->done)) line_group_leave(gls);
+    mutex_unlock(&gls->cfg_lock);
+
+    sysfs_notify(&gls->kobj, NULL, "done");
+}
+
+/* the timer callback cannot wake anyone up from hard irq context on RT */
+static void ring_work_func(struct irq_work *work){
+    struct gpio_line_state *gls = container_of(work, struct gpio_line_state, ring_work);
+    wake_up_interruptible(&gls->ring_wait);
+}
+
+/* NOTE: an open file holds a reference to the line; see rm_func() */
+static int chardev_open(struct inode *inode, struct file *file){
+    struct gpio_line_state *gls = container_of(inode->i_cdev,
+            struct gpio_line_state, cdev);
+    int rc;
+
+    /* the line is in use; see line_export() */
+    if ((rc = line_export(gls))) return rc;
+
+    mutex_lock(&gls->cfg_lock);
+
+    if (!gls->ring && !gls->cap){
+        if (!(gls->ring = vmalloc_user(PAGE_ALIGN(sizeof(struct gpioman_ring))))){
+            mutex_unlock(&gls->cfg_lock);
+            return -ENOMEM;
+        }
+        gls->ring->size = GPIOMAN_RING_ENTRIES;
+        gls->ring->flags = GPIOMAN_RING_STOPPED;
+    }
+
+    mutex_unlock(&gls->cfg_lock);
+
+    kobject_get(&gls->kobj);
+    file->private_data = gls;
+    return nonseekable_open(inode, file);
+}
+
+static int chardev_release(struct inode *inode, struct file *file){
+    struct gpio_line_state *gls = file->private_data;
+
+    kobject_put(&gls->kobj);
+    return 0;
+}
+
+static int chardev_mmap(struct file *file, struct vm_area_struct *vma){
+    struct gpio_line_state *gls = file->private_data;
+
+    if (gls->cap) return -ENODEV;
+
+    /* NOTE: fails if the vma extends past the ring */
+    return remap_vmalloc_range(vma, gls->ring, vma->vm_pgoff);
+}
+
+/* writable when at least half of the ring is free, or when stopped */
+static __poll_t chardev_poll(struct file *file, poll_table *wait){
+    struct gpio_line_state *gls = file->private_data;
+    u32 used;
+
+    poll_wait(file, &gls->ring_wait, wait);
+
+    if (gls->cap)
+        return capture_pending(gls->cap) >= READ_ONCE(gls->cap->batch) ? EPOLLIN | EPOLLRDNORM : 0;
+
+    used = READ_ONCE(gls->ring->head) - READ_ONCE(gls->ring_tail);
+    if (used <= GPIOMAN_RING_ENTRIES / 2 || atomic_read(&gls->stream_stopped))
+        return EPOLLOUT | EPOLLWRNORM;
+
+    return 0;
+}
+
+/*
+ * GPIOMAN_IOC_KICK: restart the stream if it ran empty. Only one of this and
+ * the timer callback clears stream_stopped; see stream_step(). */
+static long chardev_ioctl(struct file *file, unsigned int cmd, unsigned long arg){
+    struct gpio_line_state *gls = file->private_data;
+
+    if (cmd != GPIOMAN_IOC_KICK) return -ENOTTY;
+
+    mutex_lock(&gls->cfg_lock);
+
+    /* order the entries produced before the kick against the flag */
+    smp_mb();
+    if (gls->pin_ctl_enabled && gls->mode == MODE_STREAM && !gls->start_pending
+            && atomic_cmpxchg(&gls->stream_stopped, 1, 0) == 1)
+        start_pulse_train(gls);
+
+    mutex_unlock(&gls->cfg_lock);
+    return 0;
+}
+
+/*
+ * Input lines: copy as many pending events as fit in the buffer. Blocks
+ * until there are 'capture_batch' of them, unless O_NONBLOCK, in which case
+ * whatever there is is returned. */
+static ssize_t chardev_read(struct file *file, char __user *buf, size_t count, loff_t *ppos){
+    struct gpio_line_state *gls = file->private_data;
+    struct line_capture *cap = gls->cap;
+    u32 n, head, tail, chunk;
+    ssize_t rc;
+
+    if (!cap) return -EINVAL;
+    if (count < sizeof(struct gpioman_event)) return -EINVAL;
+
+    if (mutex_lock_interruptible(&cap->read_lock)) return -ERESTARTSYS;
+
+    if (file->f_flags & O_NONBLOCK){
+        if (!capture_pending(cap)){
+            rc = -EAGAIN;
+            goto out;
+        }
+    }
+    else if ((rc = wait_event_interruptible(gls->ring_wait,
+                    capture_pending(cap) >= max(READ_ONCE(cap->batch), 1U)))){
+        goto out;
+    }
+
+    /* pairs with the release of head in capture_irq() */
+    head = smp_load_acquire(&cap->head);
+    tail = cap->tail;
+    n = min_t(u32, head - tail, count / sizeof(struct gpioman_event));
+
+    /* in up to two chunks, since the events may wrap around */
+    chunk = min_t(u32, n, CAPTURE_RING_EVENTS - tail % CAPTURE_RING_EVENTS);
+    if (copy_to_user(buf, &cap->events[tail % CAPTURE_RING_EVENTS], chunk * sizeof(struct gpioman_event))
+            || copy_to_user(buf + chunk * sizeof(struct gpioman_event), cap->events,
+                (n - chunk) * sizeof(struct gpioman_event))){
+        rc = -EFAULT;
+        goto out;
+    }
+
+    /* the slots are free for the irq handler to reuse */
+    smp_store_release(&cap->tail, tail + n);
+    rc = n * sizeof(struct gpioman_event);
+
+out:
+    mutex_unlock(&cap->read_lock);
+    return rc;
+}
+
+static const struct file_operations chardev_fops = {
+    .owner = THIS_MODULE,
+    .open = chardev_open,
+    .release = chardev_release,
+    .read = chardev_read,
+    .mmap = chardev_mmap,
+    .poll = chardev_poll,
+    .unlocked_ioctl = chardev_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
+    .llseek = no_llseek,
+};
+
+/*
+ * The character devices of the lines are all in one region of MAX_LINES
+ * minors rather than misc devices: there are only so many dynamic misc minors
+ * for the whole system, far fewer than setups with many lines take. NOTE: the
+ * cdev holds a reference to the line, which open files do through it, until
+ * remove_gls_chardev() and the last of them is closed. */
+static int create_gls_chardev(struct gpio_line_state *gls, struct device *parent){
+    dev_t devt;
+    int rc, minor;
+
+    if ((minor = ida_alloc_max(&chardev_minors, MAX_LINES - 1, GFP_KERNEL)) < 0)
+        return minor;
+    devt = MKDEV(MAJOR(chardev_region), minor);
+
+    cdev_init(&gls->cdev, &chardev_fops);
+    gls->cdev.owner = THIS_MODULE;
+    cdev_set_parent(&gls->cdev, &gls->kobj);
+
+    if ((rc = cdev_add(&gls->cdev, devt, 1))){
+        ida_free(&chardev_minors, minor);
+        return rc;
+    }
+
+    gls->chardev = device_create(chardev_class, parent, devt, gls, "%s", gls->devname);
+    if (IS_ERR(gls->chardev)){
+        rc = PTR_ERR(gls->chardev);
+        gls->chardev = NULL;
+        cdev_del(&gls->cdev);
+        ida_free(&chardev_minors, minor);
+        return rc;
+    }
+
+    return 0;
+}
+
+/* no new opens from here on; open files keep the line around until closed */
+static void remove_gls_chardev(struct gpio_line_state *gls){
+    device_destroy(chardev_class, gls->cdev.dev);
+    cdev_del(&gls->cdev);
+    ida_free(&chardev_minors, MINOR(gls->cdev.dev));
+}
+
+/* /dev/gpioman/<devname> */
+static char *chardev_devnode(struct device *dev, umode_t *mode){
+    return kasprintf(GFP_KERNEL, KBUILD_MODNAME "/%s", dev_name(dev));
+}
+
+/*
+ * /dev/gpioman-control; see GPIOMAN_IOC_CONFIG in the uapi header.
+ * NOTE: lines_lock is held throughout, which keeps the lines from going
+ * away in the meantime, and the configuration applied in one go with respect
+ * to the 'start' driver attribute and other bulk writers. */
+static int control_check(const struct gpioman_line_config *cfg, u32 n){
+    const struct gpioman_line_config *c, *prev;
+    struct gpio_line_state *gls;
+
+    for (c = cfg; c < cfg + n; c++){
+        if (c->freq > INT_MAX || c->on_cycles > INT_MAX || c->off_cycles > INT_MAX
+                || (c->phase > INT_MAX && c->phase != GPIOMAN_PHASE_KEEP) || c->status > 1){
+            message("Invalid configuration of line %u", c->id);
+            return -EINVAL;
+        }
+
+        /* NOTE: quadratic, but in at most GPIOMAN_CONFIG_MAX entries */
+        for (prev = cfg; prev < c; prev++){
+            if (prev->id == c->id){
+                message("Invalid configuration: line %u is listed twice", c->id);
+                return -EINVAL;
+            }
+        }
+
+        if (!(gls = xa_load(&lines, c->id))){
+            message("No such line: %u", c->id);
+            return -ENOENT;
+        }
+
+        if (gls->cap){
+            message("Invalid configuration: %s is an input", gls->devname);
+            return -EPERM;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * The line of the given name (as per sysfs_streq(), i.e. give or take a
+ * trailing newline), if any; with lines_lock held. */
+static struct gpio_line_state *line_lookup(const char *name){
+    struct gpio_line_state *gls;
+    unsigned long id;
+
+    xa_for_each(&lines, id, gls){
+        if (sysfs_streq(name, gls->devname)) return gls;
+    }
+
+    return NULL;
+}
+
+/* GPIOMAN_IOC_LOOKUP */
+static long control_lookup(struct gpioman_line_lookup __user *arg){
+    struct gpioman_line_lookup req;
+    struct gpio_line_state *gls;
+    u32 id = 0;
+
+    if (copy_from_user(&req, arg, sizeof(req)))
+        return -EFAULT;
+
+    if (!memchr(req.name, '\0', sizeof(req.name)))
+        return -EINVAL;
+
+    mutex_lock(&lines_lock);
+    if ((gls = line_lookup(req.name))) id = gls->id;
+    mutex_unlock(&lines_lock);
+
+    if (!id) return -ENOENT;
+    return put_user(id, &arg->id);
+}
+
+/*
+ * GPIOMAN_CONFIG_SYNC: stop all the lines first, put their settings into
+ * effect, and then start the ones with status=1 against a common epoch; as
+ * in start_all_lines(), with the same caveats, and with the lines likewise
+ * start_pending from the first pass to the last. */
+static void control_apply_sync(const struct gpioman_line_config *cfg, u32 n){
+    const struct gpioman_line_config *c;
+    struct gpio_line_state *gls;
+    struct line_epoch epoch;
+    int freq;
+
+    for (c = cfg; c < cfg + n; c++){
+        gls = xa_load(&lines, c->id);
+        mutex_lock(&gls->cfg_lock);
+        stop_pulse_train(gls);
+        gls->start_pending = true;
+        mutex_unlock(&gls->cfg_lock);
+    }
+
+    for (c = cfg; c < cfg + n; c++){
+        gls = xa_load(&lines, c->id);
+        trace_gpioman_config(gls->devname, "freq", c->freq);
+        trace_gpioman_config(gls->devname, "on_cycles", c->on_cycles);
+        trace_gpioman_config(gls->devname, "off_cycles", c->off_cycles);
+        trace_gpioman_config(gls->devname, "status", c->status);
+
+        mutex_lock(&gls->cfg_lock);
+        freq = clamp_gls_frequency(gls, c->freq);
+        if (c->phase != GPIOMAN_PHASE_KEEP) gls->phase = c->phase;
+        set_timebase_frequency(&gls->tb, freq, backend_units_per_sec(gls->timer.backend));
+        line_params_publish(gls, freq, c->on_cycles, c->off_cycles, false);
+        line_params_sync(gls, true);
+
+        if (c->status == LOGIC_LOW) set_gls_status(gls, LOGIC_LOW);
+        else gls->pin_ctl_enabled = true;
+        mutex_unlock(&gls->cfg_lock);
+    }
+
+    line_epoch_ahead(&epoch);
+
+    for (c = cfg; c < cfg + n; c++){
+        gls = xa_load(&lines, c->id);
+        mutex_lock(&gls->cfg_lock);
+        if (gls->pin_ctl_enabled) start_pulse_train_at(gls, &epoch);
+        gls->start_pending = false;
+        mutex_unlock(&gls->cfg_lock);
+    }
+}
+
+static long control_ioctl(struct file *file, unsigned int cmd, unsigned long arg){
+    struct gpioman_config req;
+    struct gpioman_line_config *cfg, *c;
+    int rc;
+
+    if (cmd == GPIOMAN_IOC_LOOKUP)
+        return control_lookup((struct gpioman_line_lookup __user *)arg);
+    if (cmd != GPIOMAN_IOC_CONFIG) return -ENOTTY;
+
+    if (copy_from_user(&req, (void __user *)arg, sizeof(req)))
+        return -EFAULT;
+
+    if (req.count > GPIOMAN_CONFIG_MAX || req.flags & ~GPIOMAN_CONFIG_SYNC)
+        return -EINVAL;
+
+    if (!req.count) return 0;
+
+    cfg = vmemdup_user(u64_to_user_ptr(req.entries), req.count * sizeof(*cfg));
+    if (IS_ERR(cfg)) return PTR_ERR(cfg);
+
+    mutex_lock(&lines_lock);
+
+    if ((rc = control_check(cfg, req.count))) goto out;
+
+    if (req.flags & GPIOMAN_CONFIG_SYNC){
+        control_apply_sync(cfg, req.count);
+        goto out;
+    }
+
+    /* NOTE: no line is start_pending while lines_lock is held */
+    for (c = cfg; c < cfg + req.count; c++){
+        line_apply_config(xa_load(&lines, c->id), c->freq, c->on_cycles,
+                c->off_cycles, c->status,
+                c->phase == GPIOMAN_PHASE_KEEP ? -1 : (int)c->phase);
+    }
+
+out:
+    mutex_unlock(&lines_lock);
+    kvfree(cfg);
+    return rc;
+}
+
+static const struct file_operations control_fops = {
+    .owner = THIS_MODULE,
+    .unlocked_ioctl = control_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
+    .llseek = no_llseek,
+};
+
+static struct miscdevice control_miscdev = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = KBUILD_MODNAME "-control",
+    .fops = &control_fops,
+};
+
+/* =================================================
+ * ==== debugfs ====================================
+ * =================================================
+ * - diagnostics for each device (gpio line) managed,
+ *   under <debugfs>/gpioman/<devname>/
+ * -----------------------------------------------*/
+
+/*
+ * The upper bound of the bucket the given percentile (in per-mille) falls
+ * in; as close as the power-of-2 buckets get. */
+static void latency_show_percentile(struct seq_file *s, struct latency_stats *st,
+        u64 count, unsigned int permille, const char *name)
+{
+    u64 rank = div_u64(count * permille + 999, 1000), seen = 0;
+    unsigned int i;
+
+    for (i = 0; i < LATENCY_BUCKETS - 1; i++){
+        seen += READ_ONCE(st->hist[i]);
+        if (seen >= rank) break;
+    }
+
+    if (i == LATENCY_BUCKETS - 1)
+        seq_printf(s, "%s: >= %llu ns\n", name, 1ULL << (i - 1));
+    else
+        seq_printf(s, "%s: < %llu ns\n", name, i ? 1ULL << i : 1);
+}
+
+static int latency_show(struct seq_file *s, void *unused){
+    struct gpio_line_state *gls = s->private;
+    struct latency_stats *st = &gls->latency;
+    u64 count = READ_ONCE(st->count), lo, hi;
+    unsigned int i;
+
+    /* a reset is only carried out the next time the callback runs; it has
+     * not run since, so there is nothing to show */
+    if (atomic_read(&st->reset_req) != READ_ONCE(st->reset_seen)) count = 0;
+
+    seq_printf(s, "count: %llu\n", count);
+    if (!count) return 0;
+
+    seq_printf(s, "min: %llu ns\n", READ_ONCE(st->min));
+    seq_printf(s, "max: %llu ns\n", READ_ONCE(st->max));
+    seq_printf(s, "mean: %llu ns\n", div64_u64(READ_ONCE(st->sum), count));
+    latency_show_percentile(s, st, count, 500, "p50");
+    latency_show_percentile(s, st, count, 900, "p90");
+    latency_show_percentile(s, st, count, 990, "p99");
+    latency_show_percentile(s, st, count, 999, "p99.9");
+
+    if (READ_ONCE(gls->timer.comp))
+        seq_printf(s, "compensation: %llu ns HIGH, %llu ns LOW\n",
+                READ_ONCE(gls->timer.comp_ns[LOGIC_HIGH]), READ_ONCE(gls->timer.comp_ns[LOGIC_LOW]));
+
+    for (i = 0; i < LATENCY_BUCKETS; i++){
+        if (!READ_ONCE(st->hist[i])) continue;
+        lo = i ? 1ULL << (i - 1) : 0;
+        hi = i ? 1ULL << i : 1;
+
+        if (i == LATENCY_BUCKETS - 1)
+            seq_printf(s, "[%llu, inf) ns: %llu\n", lo, READ_ONCE(st->hist[i]));
+        else
+            seq_printf(s, "[%llu, %llu) ns: %llu\n", lo, hi, READ_ONCE(st->hist[i]));
+    }
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(latency);
+
+/* any write resets the latency statistics */
+static ssize_t latency_reset_write(struct file *file, const char __user *buf,
+        size_t count, loff_t *ppos)
+{
+    struct gpio_line_state *gls = file->private_data;
+
+    atomic_inc(&gls->latency.reset_req);
+    return count;
+}
+
+static const struct file_operations latency_reset_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .write = latency_reset_write,
+    .llseek = noop_llseek,
+};
+
+/*
+ * Edge rate achieved (over the callbacks timed since the last reset) vs
+ * requested, and the time spent per callback, while <debugfs>/gpioman/bench
+ * is 1. The requested rate is only known for pulse trains (mode 0). */
+static int bench_show(struct seq_file *s, void *unused){
+    struct gpio_line_state *gls = s->private;
+    struct latency_stats *st = &gls->latency;
+    u64 count = READ_ONCE(st->bench_count), span, achieved;
+    struct line_params p;
+
+    if (atomic_read(&st->reset_req) != READ_ONCE(st->reset_seen)) count = 0;
+
+    seq_printf(s, "callbacks: %llu\n", count);
+    if (!count) return 0;
 
-    debug("called write_sysfs_attribute");
+    span = READ_ONCE(st->bench_last) - READ_ONCE(st->bench_first);
+    achieved = span ? div64_u64(READ_ONCE(st->edges) * NSEC_PER_SEC, span) : 0;
 
-	if (rc < 0 || var < 0){
-        message("Invalid sysfs write: value must be positive integer");
-        return EINVAL;
-    }
+    seq_printf(s, "edges: %llu\n", READ_ONCE(st->edges));
+    seq_printf(s, "achieved: %llu edges/s\n", achieved);
 
-    gls = container_of(kobj, struct gpio_line_state, kobj);
+    line_params_read(gls, &p);
+    if (READ_ONCE(gls->mode) == MODE_PULSE && p.on_cycles > 0 && p.off_cycles > 0)
+        seq_printf(s, "requested: %llu edges/s\n",
+                div_u64(2ULL * p.freq, p.on_cycles + p.off_cycles));
 
-    /* restart state machine; NOTE: always start in the on_cycles state */
-    gls->counter = 0;
+    seq_printf(s, "cost mean: %llu ns\n", div64_u64(READ_ONCE(st->cost_sum), count));
+    seq_printf(s, "cost max: %llu ns\n", READ_ONCE(st->cost_max));
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(bench);
 
-	if (match(attribute, "status")){
-        switch(var){
+/* <debugfs>/gpioman/bench: "1" to time the callbacks, "0" to stop */
+static ssize_t bench_mode_read(struct file *file, char __user *buf,
+        size_t count, loff_t *ppos)
+{
+    char state[3] = {static_key_enabled(&bench_mode) ? '1' : '0', '\n'};
 
-        case LOGIC_LOW: /* essentially disabled; stop timer and set to low */
-#ifdef USE_HR_TIMERS
-            hrtimer_cancel(&gls->timer);
-#else
-            del_timer(&gls->timer);
-#endif
-            gls->pin_ctl_enabled = false;
-            gls->pin_logic_level = LOGIC_LOW;
-            gpiod_set_value(gls->gpio_descriptor, LOGIC_LOW);
-            break;
+    return simple_read_from_buffer(buf, count, ppos, state, 2);
+}
 
-        case LOGIC_HIGH:
-            gls->pin_logic_level = LOGIC_HIGH;
-            gpiod_set_value(gls->gpio_descriptor, LOGIC_HIGH);
+static ssize_t bench_mode_write(struct file *file, const char __user *buf,
+        size_t count, loff_t *ppos)
+{
+    bool on;
+    int rc;
 
-            if (gls->pulse_period > 0){
-                /* restart timer in case it was disabled; NOTE: if pulse_period
-                 * is 0, there are no pulses and hence no timer. Only a stable
-                 * LOGIC_HIGH state. */
-#ifdef USE_HR_TIMERS
-                hrtimer_start(&gls->timer, ms_to_ktime(0), HRTIMER_MODE_REL);
-#else
-                mod_timer(&gls->timer, jiffies+msecs_to_jiffies(gls->pulse_period));
-#endif
-            }
-            gls->pin_ctl_enabled = true;
-            break;
-        }
-    }
+    if ((rc = kstrtobool_from_user(buf, count, &on))) return rc;
 
-    else if (match(attribute, "freq")){
-        set_gls_frequency(gls, var);
-    }
-    else if (match(attribute, "on_cycles")){
-        gls->on_cycles = var;
-    }
-    else if (match(attribute, "off_cycles")){
-        gls->off_cycles = var;
-    }
+    if (on) static_branch_enable(&bench_mode);
+    else static_branch_disable(&bench_mode);
 
-    /* used whole buffer; see
-     * https://www.kernel.org/doc/html/next/filesystems/sysfs.html fmi */
-	return count;
+    return count;
+}
+
+static const struct file_operations bench_mode_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .read = bench_mode_read,
+    .write = bench_mode_write,
+    .llseek = noop_llseek,
+};
+
+/*
+ * NOTE: debugfs errors are deliberately ignored, as is the norm; the
+ * driver works the same without it. */
+static void create_gls_debugfs_entries(struct gpio_line_state *gls){
+    gls->debugfs_dir = debugfs_create_dir(gls->devname, debugfs_root);
+    debugfs_create_file("latency", 0444, gls->debugfs_dir, gls, &latency_fops);
+    debugfs_create_file("reset", 0200, gls->debugfs_dir, gls, &latency_reset_fops);
+    debugfs_create_file("bench", 0444, gls->debugfs_dir, gls, &bench_fops);
 }
+/* -----------------------------------------------------------*/
 
 /* =======================================================
  * ==== Global driver sysfs attribute callbacks ==========
@@ -315,11 +3583,49 @@ static ssize_t write_sysfs_attribute(
  * - these are called for sysfs attributes that apply to
  *   this module as a whole.
  * -----------------------------------------------*/
+/* write-only; see start_all_lines() */
+static ssize_t write_sysfs_driver_start(struct kobject *kobj,
+        struct kobj_attribute *attr, const char *buf, size_t count)
+{
+    int var = 0;
+	int rc = kstrtoint(buf, 10, &var);
+
+    debug("called %s", __func__);
+
+	if (rc < 0) return rc;
+    if (var != 1) return -EINVAL;
+
+    start_all_lines();
+    return count;
+}
+
+/* write-only: the name of a line to give its sysfs directory; see line_export() */
+static ssize_t write_sysfs_driver_export(struct kobject *kobj,
+        struct kobj_attribute *attr, const char *buf, size_t count)
+{
+    struct gpio_line_state *found;
+    int rc;
+
+    debug("called %s", __func__);
+
+    /* NOTE: a line being released is no longer there to export */
+    mutex_lock(&lines_lock);
+    found = line_lookup(buf);
+    if (found && !kobject_get_unless_zero(&found->kobj)) found = NULL;
+    mutex_unlock(&lines_lock);
+
+    if (!found) return -ENOENT;
+
+    rc = line_export(found);
+    kobject_put(&found->kobj);
+    return rc ?: count;
+}
+
 static ssize_t read_sysfs_driver_attribute(struct kobject *kobj,
         struct kobj_attribute *attr, char *buf)
 {
     debug("called %s", __func__);
-	return sprintf(buf, "%u\n", debug_mode);
+	return sprintf(buf, "%u\n", static_key_enabled(&debug_mode));
 }
 
 static ssize_t write_sysfs_driver_attribute(struct kobject *kobj,
@@ -332,7 +3638,9 @@ static ssize_t write_sysfs_driver_attribute(struct kobject *kobj,
 
 	if (rc < 0) return rc;
 
-    debug_mode = var;
+    if (var) static_branch_enable(&debug_mode);
+    else static_branch_disable(&debug_mode);
+
     return count;
 }
 /* -----------------------------------------------------------*/
@@ -343,6 +3651,12 @@ static ssize_t write_sysfs_driver_attribute(struct kobject *kobj,
 static struct kobj_attribute debug_mode_sysfs_toggle =
 	__ATTR(debug, 0664, read_sysfs_driver_attribute, write_sysfs_driver_attribute);
 
+static struct kobj_attribute start_sysfs_trigger =
+	__ATTR(start, 0220, NULL, write_sysfs_driver_start);
+
+static struct kobj_attribute export_sysfs_trigger =
+	__ATTR(export, 0220, NULL, write_sysfs_driver_export);
+
 /*
  * Per-device (i.e. per-gpio line) attributes. These are used as the default
  * attributes for the gpio_control_interface ktype and sysfs files corresponding
@@ -360,17 +3674,100 @@ static struct kobj_attribute on_cycles_attribute =
 static struct kobj_attribute off_cycles_attribute =
 	__ATTR(off_cycles, 0664, read_sysfs_attribute, write_sysfs_attribute);
 
+static struct kobj_attribute edge_sched_attribute =
+	__ATTR(edge_sched, 0664, read_sysfs_attribute, write_sysfs_attribute);
+
+static struct kobj_attribute abs_sched_attribute =
+	__ATTR(abs_sched, 0664, read_sysfs_attribute, write_sysfs_attribute);
+
+static struct kobj_attribute backend_attribute =
+	__ATTR(backend, 0664, read_sysfs_attribute, write_sysfs_attribute);
+
+static struct kobj_attribute config_attribute =
+	__ATTR(config, 0664, read_sysfs_config, write_sysfs_config);
+
+static struct kobj_attribute ramp_attribute =
+	__ATTR(ramp, 0664, read_sysfs_ramp, write_sysfs_ramp);
+
+static struct kobj_attribute compensate_attribute =
+	__ATTR(compensate, 0664, read_sysfs_attribute, write_sysfs_attribute);
+
+static struct kobj_attribute id_attribute =
+	__ATTR(id, 0444, read_sysfs_attribute, NULL);
+
+static struct kobj_attribute slack_us_attribute =
+	__ATTR(slack_us, 0664, read_sysfs_attribute, write_sysfs_attribute);
+
+static struct kobj_attribute brightness_attribute =
+	__ATTR(brightness, 0664, read_sysfs_attribute, write_sysfs_attribute);
+
+static struct kobj_attribute mode_attribute =
+	__ATTR(mode, 0664, read_sysfs_attribute, write_sysfs_attribute);
+
+static struct kobj_attribute cpu_attribute =
+	__ATTR(cpu, 0664, read_sysfs_attribute, write_sysfs_attribute);
+
+static struct kobj_attribute phase_attribute =
+	__ATTR(phase, 0664, read_sysfs_attribute, write_sysfs_attribute);
+
+static struct kobj_attribute count_attribute =
+	__ATTR(count, 0664, read_sysfs_attribute, write_sysfs_attribute);
+
+static struct kobj_attribute done_attribute =
+	__ATTR(done, 0444, read_sysfs_attribute, NULL);
+
+static struct kobj_attribute capture_batch_attribute =
+	__ATTR(capture_batch, 0664, read_sysfs_attribute, write_sysfs_attribute);
+
+static struct kobj_attribute measured_freq_attribute =
+	__ATTR(measured_freq, 0444, read_sysfs_attribute, NULL);
+
+static struct kobj_attribute measured_duty_attribute =
+	__ATTR(measured_duty, 0444, read_sysfs_attribute, NULL);
+
+static struct kobj_attribute overruns_attribute =
+	__ATTR(overruns, 0444, read_sysfs_attribute, NULL);
+
 static struct attribute *default_gpio_control_interface_attributes[] = {
 	&pin_logic_level_attribute.attr,
 	&freq_attribute.attr,
     &on_cycles_attribute.attr,
     &off_cycles_attribute.attr,
+    &edge_sched_attribute.attr,
+    &abs_sched_attribute.attr,
+    &backend_attribute.attr,
+    &cpu_attribute.attr,
+    &config_attribute.attr,
+    &ramp_attribute.attr,
+    &mode_attribute.attr,
+    &phase_attribute.attr,
+    &brightness_attribute.attr,
+    &slack_us_attribute.attr,
+    &compensate_attribute.attr,
+    &id_attribute.attr,
+    &count_attribute.attr,
+    &done_attribute.attr,
+    &capture_batch_attribute.attr,
+    &measured_freq_attribute.attr,
+    &measured_duty_attribute.attr,
+    &overruns_attribute.attr,
 	NULL
 };
 
+/* take down the line and the other lines of the same DT node after it */
+static void remove_lines(struct gpio_line_state *gls){
+    struct gpio_line_state *next;
+
+    for (; gls; gls = next){
+        next = gls->sibling;
+
+        remove_gls_chardev(gls);
+        kobject_put(&gls->kobj);   /* let the release callback do its thing */
+    }
+}
+
 static int rm_func(struct platform_device *pdev){
-    struct gpio_line_state *gls = dev_get_drvdata(&pdev->dev);
-    kobject_put(&gls->kobj);   /* let the release callback do its thing */
+    remove_lines(dev_get_drvdata(&pdev->dev));
     return 0;
 }
 
@@ -382,18 +3779,30 @@ static void gpio_line_state_release_func(struct kobject *kobj){
     struct gpio_line_state *gls = container_of(kobj, struct gpio_line_state, kobj);
     debug("Kobj release called for device %s", gls->devname);
 
-#ifdef USE_HR_TIMERS
-    hrtimer_cancel(&gls->timer);
-#else
-    /* NOTE: recent kernels will have renamed this to
-     * timer_delete_sync(&gls->timer). Not so on 5.15 */
-    del_timer_sync(&gls->timer);
-#endif
+    /* first, so that start_all_lines() is done with the line */
+    if (gls->id){
+        mutex_lock(&lines_lock);
+        xa_erase(&lines, gls->id);
+        mutex_unlock(&lines_lock);
+    }
 
-    gpiod_set_value(gls->gpio_descriptor, LOGIC_LOW);
-    gpiod_put(gls->gpio_descriptor);
-    list_del(&gls->list);
-    kfree(gls);
+    stop_pulse_train(gls);
+    cancel_work_sync(&gls->done_work);
+    if (gls->cap && gls->cap->irq >= 0) free_irq(gls->cap->irq, gls);
+    line_dma_free(gls->dma);
+    if (gls->pwm_pinctrl) pinctrl_put(gls->pwm_pinctrl);
+    if (gls->pwm) pwm_put(gls->pwm);
+    gpio_regs_put(gls->io.regs);
+    irq_work_sync(&gls->ring_work);
+    debugfs_remove_recursive(gls->debugfs_dir);
+
+    if (!gls->cap) line_write(gls, LOGIC_LOW);
+    put_line_gpios(gls->gpio_descriptor, gls->port);
+    kvfree(gls->cap);
+    kvfree(gls->pattern);
+    kvfree(gls->pattern_staging);
+    vfree(gls->ring);
+    kmem_cache_free(gls_cache, gls);
 }
 
 /*
@@ -407,7 +3816,7 @@ static ssize_t gls_show_func(struct kobject *kobj,
     debug("%s called", __func__);
 
     kattr = container_of(attr, struct kobj_attribute, attr);
-    return read_sysfs_attribute(kobj, kattr, buffer);
+    return kattr->show ? kattr->show(kobj, kattr, buffer) : -EIO;
 }
 
 static ssize_t gls_store_func(struct kobject *kobj,
@@ -418,7 +3827,7 @@ static ssize_t gls_store_func(struct kobject *kobj,
     debug("%s called", __func__);
 
     kattr = container_of(attr, struct kobj_attribute, attr);
-    return write_sysfs_attribute(kobj, kattr, buffer, count);
+    return kattr->store ? kattr->store(kobj, kattr, buffer, count) : -EIO;
 }
 
 static const struct sysfs_ops gpio_control_interface_syfs_ops = {
@@ -433,59 +3842,447 @@ static struct kobj_type gpio_control_interface_ktype = {
 	.default_attrs = default_gpio_control_interface_attributes,
 };
 
+/* an input line, for input capture, rather than an output; see struct line_capture */
+static inline bool dt_line_is_input(struct platform_device *pdev){
+    return of_property_read_bool(pdev->dev.of_node, "vcstech,input");
+}
+
+/* no sysfs directories until asked for; see line_export() */
+static inline bool dt_lazy_sysfs(struct platform_device *pdev){
+    return of_property_read_bool(pdev->dev.of_node, "vcstech,lazy-sysfs");
+}
+
+/* the number of lines the node describes; see probe_line_set() */
+static inline int dt_line_names(struct platform_device *pdev){
+    return of_property_count_strings(pdev->dev.of_node, "vcstech,line-names");
+}
+
+/*
+ * Timer backend to use for the line initially, as per the optional
+ * vcstech,timer-backend DT property ("lowres", "hrtimer" or "hrtimer-hard").
+ * Defaults to the one picked at build time; see USE_HR_TIMERS. */
+static int dt_timer_backend(struct platform_device *pdev){
+    const char *of_prop;
+    int i;
+
+    if (of_property_read_string(pdev->dev.of_node, "vcstech,timer-backend", &of_prop))
+        return DEFAULT_BACKEND;
+
+    for (i = 0; i < NUM_BACKENDS; i++){
+        if (match(of_prop, backend_names[i])) return i;
+    }
+
+    message("Unknown timer backend '%s'; using default", of_prop);
+    return DEFAULT_BACKEND;
+}
+
+/*
+ * Set up the DMA backend for the line (see struct line_dma) if its DT node
+ * has what it takes, e.g. for a line on GPIO 18:
+ *
+ *     vcstech,dma-pwm = <&pwm 0>;   // PWM block and channel the pin goes to
+ *     dmas = <&dma 5>;              // DMA channel paced by the PWM DREQ
+ *     dma-names = "tx";
+ *     pinctrl-names = "dma";
+ *     pinctrl-0 = <&pwm0_gpio18>;   // the pin muxed to that channel
+ *
+ * NOTE: the pwm node itself must be disabled. If there is no such setup or
+ * it fails, gls->dma is left NULL and the line can only use the timer
+ * backends; only a deferred probe is an error. */
+static int line_dma_init(struct gpio_line_state *gls, struct platform_device *pdev){
+    struct dma_slave_config cfg = {
+        .direction = DMA_MEM_TO_DEV,
+        .dst_addr_width = DMA_SLAVE_BUSWIDTH_4_BYTES,
+    };
+    struct of_phandle_args args;
+    struct line_dma *dma;
+    const __be32 *addr;
+    int rc;
+
+    if (of_parse_phandle_with_fixed_args(pdev->dev.of_node, "vcstech,dma-pwm", 1, 0, &args))
+        return 0;
+
+    if (!of_device_is_compatible(args.np, "brcm,bcm2835-pwm") || args.args[0] > 1){
+        message("%s: vcstech,dma-pwm is not a bcm2835 PWM channel; no DMA backend",
+                gls->devname);
+        of_node_put(args.np);
+        return 0;
+    }
+
+    if (!(dma = kzalloc(sizeof(struct line_dma), GFP_KERNEL))){
+        of_node_put(args.np);
+        return -ENOMEM;
+    }
+
+    /* NOTE: the DMA controller sees the peripherals at their bus addresses,
+     * which is what the DT has before translation */
+    dma->channel = args.args[0];
+    addr = of_get_address(args.np, 0, NULL, NULL);
+    dma->pwm = of_iomap(args.np, 0);
+    dma->clk = of_clk_get(args.np, 0);
+    of_node_put(args.np);
+
+    if (!addr || !dma->pwm || IS_ERR(dma->clk)){
+        rc = -ENODEV;
+        goto fail;
+    }
+    cfg.dst_addr = be32_to_cpup(addr) + PWM_FIF1;
+
+    dma->chan = dma_request_chan(&pdev->dev, "tx");
+    if (IS_ERR(dma->chan)){
+        rc = PTR_ERR(dma->chan);
+        dma->chan = NULL;
+        goto fail;
+    }
+
+    dma->pinctrl = pinctrl_get(&pdev->dev);
+    if (IS_ERR(dma->pinctrl)){
+        rc = PTR_ERR(dma->pinctrl);
+        dma->pinctrl = NULL;
+        goto fail;
+    }
+
+    dma->pins = pinctrl_lookup_state(dma->pinctrl, "dma");
+    if (IS_ERR(dma->pins)){
+        rc = PTR_ERR(dma->pins);
+        goto fail;
+    }
+
+    if ((rc = dmaengine_slave_config(dma->chan, &cfg))) goto fail;
+
+    dma->buf = dma_alloc_coherent(dma->chan->device->dev, DMA_BUF_WORDS * sizeof(u32),
+            &dma->buf_dma, GFP_KERNEL);
+    if (!dma->buf){
+        rc = -ENOMEM;
+        goto fail;
+    }
+
+    gls->dma = dma;
+    return 0;
+
+fail:
+    line_dma_free(dma);
+    if (rc == -EPROBE_DEFER) return rc;
+
+    message("%s: failed to set up the DMA backend (%d)", gls->devname, rc);
+    return 0;
+}
+
+/*
+ * The gpio controllers the fast paths are for: the SoC ones of the Raspberry
+ * Pi, which are never unbound and whose pins are not reconfigured behind
+ * gpiolib's back other than by the DMA and PWM backends, which mux them
+ * back to the gpio function when done. */
+static const char * const line_io_fast_compat[] = {
+    "brcm,bcm2835-gpio",
+    "brcm,bcm2711-gpio",
+    NULL
+};
+
+/*
+ * Pick the fastest way for the timer callbacks to write the line (see struct
+ * line_io): gpios of the controllers in line_io_fast_compat get their
+ * GPSET/GPCLR registers written directly, or failing that the set() op of
+ * their chip called directly. Gpios that can sleep are left to io_worker,
+ * and all others (including open-drain/open-source ones) to gpiolib.
+ * Active-low is resolved here, once. 'index' is that of the line in
+ * custom-gpios.
+ * NOTE: the fast paths bypass gpiolib altogether, hence the allow-list: the
+ * chip pointer they keep is only safe for controllers that never go away. */
+static void line_io_init(struct gpio_line_state *gls, struct platform_device *pdev,
+        unsigned int index)
+{
+    struct line_io *io = &gls->io;
+    struct gpio_desc *desc = gls->gpio_descriptor;
+    struct gpio_chip *chip = gpiod_to_chip(desc);
+    enum of_gpio_flags flags = 0;
+    struct of_phandle_args spec;
+    struct device_node *np;
+    unsigned int bank;
+
+    io->kind = IO_GPIOD;
+    io->active_low = gpiod_is_active_low(desc);
+
+    /* NOTE: gpiod_get_array() has already worked out whether the lines can
+     * be written with a single register access (see struct gpio_array) */
+    if (gls->port){
+        io->kind = IO_PORT;
+        return;
+    }
+
+    if (gpiod_cansleep(desc)){
+        io->kind = IO_WORKER;
+        return;
+    }
+
+    /* NOTE: on chips that cannot do open drain (or open source) natively,
+     * gpiolib emulates it by switching the line between input and output
+     * rather than setting its value; writing it straight to the pin would
+     * drive it push-pull. The descriptor does not tell, hence the DT flags */
+    of_get_named_gpio_flags(pdev->dev.of_node, GPIO_FUNCTION "-gpios", index, &flags);
+    if (flags & OF_GPIO_SINGLE_ENDED) return;
+
+    if (!chip || !chip->set) return;
+
+    np = chip->parent ? chip->parent->of_node : NULL;
+    if (!np || !of_device_compatible_match(np, line_io_fast_compat)) return;
+
+    /* NOTE: the offset of the line on its chip, as gpiolib works it out
+     * (the hwgpio of the descriptor); these controllers take it as the
+     * first cell of the specifier, and desc_to_gpio() would go through the
+     * deprecated global numbering */
+    if (of_parse_phandle_with_args(pdev->dev.of_node, GPIO_FUNCTION "-gpios",
+                "#gpio-cells", index, &spec))
+        return;
+    of_node_put(spec.np);
+    if (spec.np != chip->of_node || spec.args_count < 1 || spec.args[0] >= chip->ngpio)
+        return;
+
+    io->chip = chip;
+    io->offset = spec.args[0];
+    io->kind = IO_CHIP;
+
+    if (!(io->regs = gpio_regs_get(np))) return;
+
+    bank = io->offset / 32;
+    io->set_reg = io->regs->base + BCM2835_GPSET0 + bank * sizeof(u32);
+    io->clr_reg = io->regs->base + BCM2835_GPCLR0 + bank * sizeof(u32);
+    io->mask = BIT(io->offset % 32);
+    io->kind = IO_MMIO;
+}
+
+/*
+ * Look up the PWM channel of the line, if its DT node has one:
+ *
+ *     pwms = <&pwm 0 1000000>;
+ *     pinctrl-names = "pwm";        // optional: for pins that need to be
+ *     pinctrl-0 = <&pwm0_gpio18>;   // muxed away from the gpio function
+ *
+ * Only a deferred probe is an error; otherwise the line simply goes without. */
+static int line_pwm_init(struct gpio_line_state *gls, struct platform_device *pdev){
+    struct pinctrl_state *pins;
+    int rc;
+
+    if (!of_find_property(pdev->dev.of_node, "pwms", NULL)) return 0;
+
+    gls->pwm = pwm_get(&pdev->dev, NULL);
+    if (IS_ERR(gls->pwm)){
+        rc = PTR_ERR(gls->pwm);
+        gls->pwm = NULL;
+        if (rc == -EPROBE_DEFER) return rc;
+
+        message("%s: failed to get PWM (%d); using the timer instead", gls->devname, rc);
+        return 0;
+    }
+
+    gls->pwm_pinctrl = pinctrl_get(&pdev->dev);
+    if (IS_ERR(gls->pwm_pinctrl)){
+        gls->pwm_pinctrl = NULL;
+        return 0;
+    }
+
+    pins = pinctrl_lookup_state(gls->pwm_pinctrl, "pwm");
+    gls->pwm_pins = IS_ERR(pins) ? NULL : pins;
+    return 0;
+}
+
+/*
+ * Get the lines of a device node that lists more than one in custom-gpios,
+ * to be driven as a parallel port: a word at a time, bit i the i-th line.
+ * NOTE: the word is written straight from the timer callbacks, hence lines
+ * that can sleep are not supported. */
+static struct gpio_descs *get_line_port(struct device *dev, const char *device_name){
+    struct gpio_descs *port;
+    unsigned int i;
+
+    port = gpiod_get_array(dev, GPIO_FUNCTION, GPIOD_OUT_LOW);
+    if (IS_ERR(port)){
+        message("Failed to get GPIO descriptors for device %s", device_name);
+        return port;
+    }
+
+    if (port->ndescs > PORT_MAX_LINES){
+        message("%s: a parallel port has at most %d lines", device_name, PORT_MAX_LINES);
+        gpiod_put_array(port);
+        return ERR_PTR(-EINVAL);
+    }
+
+    for (i = 0; i < port->ndescs; i++){
+        if (gpiod_cansleep(port->desc[i])){
+            message("%s: the lines of a parallel port must not sleep", device_name);
+            gpiod_put_array(port);
+            return ERR_PTR(-EINVAL);
+        }
+    }
+
+    return port;
+}
+
 /*
- * Initialize state variables to defaults.
+ * Initialize state variables to defaults. 'index' is that of the line in
+ * custom-gpios (0 for a port).
  */
 static inline int initialize_gls(
         struct gpio_line_state *gls,
         struct platform_device *pdev,
         struct gpio_desc *desc,
+        unsigned int index,
         const char *device_name
         )
 {
-    int rc;
+    int rc, backend = dt_timer_backend(pdev);
+    bool shared = dt_line_names(pdev) > 0;
 
     gls->devname = device_name;
     gls->gpio_descriptor = desc;
 
+    if (dt_line_is_input(pdev)){
+        if (!(gls->cap = kvzalloc(sizeof(struct line_capture), GFP_KERNEL))){
+            message("Memory allocation failure");
+            gpiod_put(desc); kmem_cache_free(gls_cache, gls);
+            return -ENOMEM;
+        }
+        gls->cap->irq = -1;
+        gls->cap->batch = 1;
+        mutex_init(&gls->cap->read_lock);
+    }
+
+    /* NOTE: neither applies to a parallel port or an input, nor to the
+     * lines of a node with several, with which there is one pin to go with
+     * the DMA or PWM channel of the node and several lines */
+    if (!gls->port && !gls->cap && !shared && (rc = line_dma_init(gls, pdev))){
+        put_line_gpios(desc, gls->port); kmem_cache_free(gls_cache, gls);
+        return rc;
+    }
+
+    if (!gls->port && !gls->cap && !shared && (rc = line_pwm_init(gls, pdev))){
+        line_dma_free(gls->dma);
+        put_line_gpios(desc, gls->port); kmem_cache_free(gls_cache, gls);
+        return rc;
+    }
+
+    line_io_init(gls, pdev, index);
+
+    /* see the 'backend' sysfs attribute */
+    if (backend == BACKEND_DMA && !gls->dma){
+        message("%s: no DMA backend; using high-res timers instead", device_name);
+        backend = BACKEND_HRTIMER;
+    }
+
     /* Always LOW (and no timer) by default */
-    gls->pulse_period = 0;
+    set_timebase_frequency(&gls->tb, 0, backend_units_per_sec(backend));
     gls->pin_logic_level = LOGIC_LOW;
 
     /* alternate between high and low (=>square wave, 50% duty cycle)
      * by default, when user sets status=1 (HIGH) */
     gls->on_cycles = 1;
     gls->off_cycles = 1;
+    gls->params.on_cycles = gls->on_cycles;
+    gls->params.off_cycles = gls->off_cycles;
 
-#ifdef USE_HR_TIMERS
-    hrtimer_init(&gls->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
-    gls->timer.function = hr_interval_cb;
-#else
-    timer_setup(&gls->timer, lr_interval_cb, 0);
-#endif
+    /* a port has no pulse train to generate */
+    if (gls->port) gls->mode = MODE_PATTERN_LOOP;
 
-    INIT_LIST_HEAD(&gls->list);
-    list_add(&gls->list, &list);
+    line_timer_init(&gls->timer, backend, -1, hr_interval_cb, lr_interval_cb);
 
-    dev_set_drvdata(&pdev->dev, gls);
+    INIT_LIST_HEAD(&gls->group_node);
+    gls->group = NULL;
+    mutex_init(&gls->cfg_lock);
+    raw_spin_lock_init(&gls->params_lock);
+    seqcount_raw_spinlock_init(&gls->params_seq, &gls->params_lock);
 
-    /* create a sysfs directory with the given name for each device,
-     * populated with the default attributes specified for
-     * gpio_control_interface_ktype */
-    rc = kobject_init_and_add(
-            &gls->kobj,
-            &gpio_control_interface_ktype,
-            driver_sysfs_entry,  /* nest entries under the driver directory */
-            device_name);
+    atomic_set(&gls->stream_stopped, 1);
+    init_waitqueue_head(&gls->ring_wait);
+    init_irq_work(&gls->ring_work, ring_work_func);
+    INIT_WORK(&gls->done_work, done_work_func);
 
-    if (rc){
-        message("Failed to initialize kobject (%d) for %s", rc, device_name);
+    gls->latency.min = U64_MAX;
+    create_gls_debugfs_entries(gls);
+
+    /* a sysfs directory with the given name for each device, populated
+     * with the default attributes specified for
+     * gpio_control_interface_ktype, is created by line_export(); the
+     * kobject is set up here regardless, since it holds the references to
+     * the line */
+    kobject_init(&gls->kobj, &gpio_control_interface_ktype);
+
+    if ((rc = xa_alloc(&lines, &gls->id, gls, xa_limit_31b, GFP_KERNEL))){
+        message("Failed to index %s (%d)", device_name, rc);
+        kobject_put(&gls->kobj);
+        return rc;
+    }
+
+    if (!dt_lazy_sysfs(pdev) && (rc = line_export(gls))){
+        kobject_put(&gls->kobj);
+        return rc;
+    }
+
+    if ((rc = create_gls_chardev(gls, &pdev->dev))){
+        message("Failed to create character device (%d) for %s", rc, device_name);
+        kobject_put(&gls->kobj);
+        return rc;
+    }
+
+    if (gls->cap && (rc = line_capture_start(gls))){
+        remove_gls_chardev(gls);
         kobject_put(&gls->kobj);
     }
 
     return rc;
 }
 
+/*
+ * A node with vcstech,line-names describes that many independent lines
+ * rather than a single one (or a parallel port), one for each line in
+ * custom-gpios and named after its entry; e.g. for a bank of LEDs, which
+ * then take one platform device rather than one each. The lines are chained
+ * through 'sibling', the first being the drvdata of the device. */
+static int probe_line_set(struct platform_device *pdev, const char *of_prop, int n){
+    struct gpio_line_state *gls, *first = NULL, **tail = &first;
+    struct gpio_desc *desc;
+    const char *name;
+    int i, rc;
+
+    if (gpiod_count(&pdev->dev, GPIO_FUNCTION) != n){
+        message("%s: vcstech,line-names must name each of the custom-gpios", of_prop);
+        return -EINVAL;
+    }
+
+    for (i = 0; i < n; i++){
+        if ((rc = of_property_read_string_index(pdev->dev.of_node, "vcstech,line-names", i, &name)))
+            goto fail;
+
+        desc = gpiod_get_index(&pdev->dev, GPIO_FUNCTION, i,
+                dt_line_is_input(pdev) ? GPIOD_IN : GPIOD_OUT_LOW);
+        if (IS_ERR(desc)){
+            message("Failed to get GPIO descriptor for device %s", name);
+            rc = PTR_ERR(desc);
+            goto fail;
+        }
+
+        if (! (gls = kmem_cache_zalloc(gls_cache, GFP_KERNEL))){
+            message("Memory allocation failure");
+            gpiod_put(desc);
+            rc = -ENOMEM;
+            goto fail;
+        }
+
+        /* NOTE: cleans up after itself on failure */
+        if ((rc = initialize_gls(gls, pdev, desc, i, name))) goto fail;
+
+        *tail = gls;
+        tail = &gls->sibling;
+        message("Bound to device: '%s' (id %u)", name, gls->id);
+    }
+
+    dev_set_drvdata(&pdev->dev, first);
+    return 0;
+
+fail:
+    remove_lines(first);
+    return rc;
+}
+
 /*
  * Called when a matching device is found. Return 0 to confirm to
  * confirm the match as valid and proceed with binding the device
@@ -495,6 +4292,7 @@ static int gpio_probe_func(struct platform_device *pdev){
     const char *of_prop = "";
     struct gpio_line_state *gls = NULL;
     struct gpio_desc *desc = NULL;
+    struct gpio_descs *port = NULL;
     int rc;
 
     debug("%s called", __func__);
@@ -504,20 +4302,38 @@ static int gpio_probe_func(struct platform_device *pdev){
         return rc;
     }
 
-    desc = gpiod_get(&pdev->dev, GPIO_FUNCTION, GPIOD_OUT_LOW);
-    if (IS_ERR(desc)){
-        message("Failed to get GPIO descriptor for device %s", of_prop);
-        return PTR_ERR(desc);
+    if ((rc = dt_line_names(pdev)) > 0)
+        return probe_line_set(pdev, of_prop, rc);
+
+    if (gpiod_count(&pdev->dev, GPIO_FUNCTION) > 1){
+        if (dt_line_is_input(pdev)){
+            message("%s: a parallel port cannot be an input", of_prop);
+            return -EINVAL;
+        }
+
+        port = get_line_port(&pdev->dev, of_prop);
+        if (IS_ERR(port)) return PTR_ERR(port);
+        desc = port->desc[0];
+    }
+    else {
+        desc = gpiod_get(&pdev->dev, GPIO_FUNCTION,
+                dt_line_is_input(pdev) ? GPIOD_IN : GPIOD_OUT_LOW);
+        if (IS_ERR(desc)){
+            message("Failed to get GPIO descriptor for device %s", of_prop);
+            return PTR_ERR(desc);
+        }
     }
 
-    if (! (gls = kzalloc(sizeof(struct gpio_line_state), GFP_KERNEL))){
+    if (! (gls = kmem_cache_zalloc(gls_cache, GFP_KERNEL))){
         message("Memory allocation failure");
-        gpiod_put(desc); return -ENOMEM;
+        put_line_gpios(desc, port); return -ENOMEM;
     }
 
-    if ((rc = initialize_gls(gls, pdev, desc, of_prop))) return rc;
+    gls->port = port;
+    if ((rc = initialize_gls(gls, pdev, desc, 0, of_prop))) return rc;
 
-    message("Bound to device: '%s'", of_prop);
+    dev_set_drvdata(&pdev->dev, gls);
+    message("Bound to device: '%s' (id %u)", of_prop, gls->id);
     return 0;
 }
 
@@ -552,10 +4368,18 @@ static struct platform_driver gpioman_driver  = {
     .driver   = {
         .name = "gpioman-driver",
         .of_match_table = dt_comp_match_specs,
-        .owner = THIS_MODULE
+        .owner = THIS_MODULE,
+        /* NOTE: nothing is shared between devices but what is under a lock
+         * anyway, so the devices of an overlay can be probed in parallel,
+         * and off the path of the module load */
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS
     }
 };
 
+#ifdef GPIOMAN_KUNIT
+#include "gpioman_kunit.c"
+#endif
+
 static int __init initialize(void) {
 	int rc;
 
@@ -570,15 +4394,88 @@ static int __init initialize(void) {
         return -ENOMEM;
     }
 
-    if (sysfs_create_file(driver_sysfs_entry, &debug_mode_sysfs_toggle.attr)){
+    if (sysfs_create_file(driver_sysfs_entry, &debug_mode_sysfs_toggle.attr) ||
+            sysfs_create_file(driver_sysfs_entry, &start_sysfs_trigger.attr) ||
+            sysfs_create_file(driver_sysfs_entry, &export_sysfs_trigger.attr)){
         message("Failed to create sysfs driver attribute");
         kobject_put(driver_sysfs_entry); driver_sysfs_entry = NULL;
         return -ENOMEM;
     }
 
+    /* NOTE: RT, since the worker stands in for the timer callback; lowest
+     * RT priority though, since it waits on slow buses */
+    kthread_init_work(&io_work, io_work_func);
+    io_worker = kthread_create_worker(0, KBUILD_MODNAME "-io");
+    if (IS_ERR(io_worker)){
+        message("Failed to create worker");
+        kobject_put(driver_sysfs_entry); driver_sysfs_entry = NULL;
+        return PTR_ERR(io_worker);
+    }
+    sched_set_fifo_low(io_worker->task);
+
+    /* NOTE: cache line aligned, which the layout of gpio_line_state
+     * counts on */
+    gls_cache = KMEM_CACHE(gpio_line_state, SLAB_HWCACHE_ALIGN);
+    if (!gls_cache){
+        message("Failed to create slab cache");
+        kthread_destroy_worker(io_worker);
+        kobject_put(driver_sysfs_entry); driver_sysfs_entry = NULL;
+        return -ENOMEM;
+    }
+
+    if ((rc = alloc_chrdev_region(&chardev_region, 0, MAX_LINES, KBUILD_MODNAME))){
+        message("Failed to allocate character device region (%d)", rc);
+        kmem_cache_destroy(gls_cache);
+        kthread_destroy_worker(io_worker);
+        kobject_put(driver_sysfs_entry); driver_sysfs_entry = NULL;
+        return rc;
+    }
+
+    chardev_class = class_create(THIS_MODULE, KBUILD_MODNAME);
+    if (IS_ERR(chardev_class)){
+        message("Failed to create device class");
+        unregister_chrdev_region(chardev_region, MAX_LINES);
+        kmem_cache_destroy(gls_cache);
+        kthread_destroy_worker(io_worker);
+        kobject_put(driver_sysfs_entry); driver_sysfs_entry = NULL;
+        return PTR_ERR(chardev_class);
+    }
+    chardev_class->devnode = chardev_devnode;
+
+    if ((rc = misc_register(&control_miscdev))){
+        message("Failed to create control device (%d)", rc);
+        class_destroy(chardev_class);
+        unregister_chrdev_region(chardev_region, MAX_LINES);
+        kmem_cache_destroy(gls_cache);
+        kthread_destroy_worker(io_worker);
+        kobject_put(driver_sysfs_entry); driver_sysfs_entry = NULL;
+        return rc;
+    }
+
+    /* NOTE: all devices get a subdirectory here */
+    debugfs_root = debugfs_create_dir(KBUILD_MODNAME, NULL);
+    debugfs_create_file("bench", 0644, debugfs_root, NULL, &bench_mode_fops);
+
+#ifdef GPIOMAN_KUNIT
+    /* NOTE: not kunit_test_suites(), which would define a module_init() of
+     * its own. Before any line is probed, since some tests stand in for
+     * io_work_func(); see gpioman_kunit.c */
+    __kunit_test_suites_init(gpioman_kunit_suites);
+#endif
+
     if ((rc = platform_driver_register(&gpioman_driver))){
         message("Failed to register driver (%d)", rc);
+#ifdef GPIOMAN_KUNIT
+        __kunit_test_suites_exit(gpioman_kunit_suites);
+#endif
+        debugfs_remove_recursive(debugfs_root);
+        misc_deregister(&control_miscdev);
+        class_destroy(chardev_class);
+        unregister_chrdev_region(chardev_region, MAX_LINES);
+        kmem_cache_destroy(gls_cache);
+        kthread_destroy_worker(io_worker);
         kobject_put(driver_sysfs_entry); driver_sysfs_entry = NULL;
+        return rc;
     }
 
 	return rc;
@@ -586,16 +4483,26 @@ static int __init initialize(void) {
 
 static void __exit cleanup(void) {
     struct gpio_line_state *gls;
+    unsigned long id;
 
+    misc_deregister(&control_miscdev);
     if (driver_sysfs_entry) kobject_put(driver_sysfs_entry);
     platform_driver_unregister(&gpioman_driver);
 
-    list_for_each_entry(gls, &list, list){
+    xa_for_each(&lines, id, gls){
         /* trigger the release() callback of each gls instance
          * still present */
         kobject_put(&gls->kobj);
     }
 
+    class_destroy(chardev_class);
+    unregister_chrdev_region(chardev_region, MAX_LINES);
+    kmem_cache_destroy(gls_cache);
+    kthread_destroy_worker(io_worker);
+    debugfs_remove_recursive(debugfs_root);
+#ifdef GPIOMAN_KUNIT
+    __kunit_test_suites_exit(gpioman_kunit_suites);
+#endif
     message("module unloaded");
 }
 
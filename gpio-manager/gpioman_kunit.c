@@ -0,0 +1,492 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * KUnit tests for the timing helpers of gpioman.c; not built on its own but
+ * included at the end of it (with KUNIT=y, see the Makefile), since all it
+ * tests is static. The suites run when the module is loaded, before the
+ * driver is registered, and report in the kernel log and <debugfs>/kunit/.
+ *
+ * Each test works on a gpio_line_state of its own, zeroed: no pulse count,
+ * no ramp and no parameters published, so the state machines never call
+ * out to line_done() or pick up new settings; except where a test sets a
+ * count, and a done_work that does nothing. The tests pick the backend of
+ * their lines themselves where it matters, so the suite is the same
+ * whether or not the module is built with USE_HR_TIMERS.
+ */
+#include <kunit/test.h>
+
+static struct gpio_line_state *test_gls(struct kunit *test, int on, int off){
+    struct gpio_line_state *gls = kunit_kzalloc(test, sizeof(*gls), GFP_KERNEL);
+
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, gls);
+    gls->on_cycles = on;
+    gls->off_cycles = off;
+    gls->pin_logic_level = LOGIC_HIGH;
+    return gls;
+}
+
+/* ==== timebase ==== */
+
+/* the slots add up to exactly one second, whether or not freq divides it */
+static void timebase_average_test(struct kunit *test){
+    static const u32 freqs[] = { 1000, 3, 7919, 30000, 999983 };
+    struct slot_timebase tb;
+    unsigned int i;
+    u64 sum, n;
+
+    for (i = 0; i < ARRAY_SIZE(freqs); i++){
+        set_timebase_frequency(&tb, freqs[i], NSEC_PER_SEC);
+        for (sum = 0, n = 0; n < freqs[i]; n++) sum += slots_to_interval(&tb, 1);
+        KUNIT_EXPECT_EQ(test, sum, (u64)NSEC_PER_SEC);
+        KUNIT_EXPECT_EQ(test, tb.phase_acc, 0U);
+
+        /* and the same in one go */
+        set_timebase_frequency(&tb, freqs[i], NSEC_PER_SEC);
+        KUNIT_EXPECT_EQ(test, slots_to_interval(&tb, freqs[i]), (u64)NSEC_PER_SEC);
+        KUNIT_EXPECT_EQ(test, tb.phase_acc, 0U);
+    }
+
+    /* low-res: no slot shorter than the period rounded down */
+    set_timebase_frequency(&tb, 3, 250);
+    KUNIT_EXPECT_EQ(test, slots_to_interval(&tb, 1), 83ULL);
+    KUNIT_EXPECT_EQ(test, slots_to_interval(&tb, 1), 83ULL);
+    KUNIT_EXPECT_EQ(test, slots_to_interval(&tb, 1), 84ULL);
+}
+
+/* a long interval spends the phase accumulator the way single slots do */
+static void timebase_split_test(struct kunit *test){
+    struct slot_timebase a, b;
+    u64 sum = 0, n;
+
+    set_timebase_frequency(&a, 7919, NSEC_PER_SEC);
+    set_timebase_frequency(&b, 7919, NSEC_PER_SEC);
+
+    for (n = 0; n < 12345; n++) sum += slots_to_interval(&a, 1);
+    KUNIT_EXPECT_EQ(test, slots_to_interval(&b, 12345), sum);
+    KUNIT_EXPECT_EQ(test, b.phase_acc, a.phase_acc);
+}
+
+static void interval_to_slots_test(struct kunit *test){
+    struct slot_timebase tb;
+
+    set_timebase_frequency(&tb, 1000, NSEC_PER_SEC);
+    KUNIT_EXPECT_EQ(test, interval_to_slots(&tb, 0), 0ULL);
+    KUNIT_EXPECT_EQ(test, interval_to_slots(&tb, 999999), 0ULL);
+    KUNIT_EXPECT_EQ(test, interval_to_slots(&tb, 5 * NSEC_PER_MSEC), 5ULL);
+    KUNIT_EXPECT_EQ(test, interval_to_slots(&tb, 6 * NSEC_PER_MSEC - 1), 5ULL);
+}
+
+/* ==== absolute-deadline catch-up ==== */
+
+static void slot_sched_catch_up_test(struct kunit *test){
+    const u64 ms = NSEC_PER_MSEC;
+    struct slot_timebase tb;
+    u64 slots, next;
+
+    /* on time: the next deadline is a slot on */
+    set_timebase_frequency(&tb, 1000, NSEC_PER_SEC);
+    next = slot_sched_catch_up(&tb, 0, &slots);
+    KUNIT_EXPECT_EQ(test, slots, 1ULL);
+    KUNIT_EXPECT_EQ(test, next, ms);
+
+    /* 3.5 slots late: 3 more deadlines have passed */
+    set_timebase_frequency(&tb, 1000, NSEC_PER_SEC);
+    next = slot_sched_catch_up(&tb, 3 * ms + ms / 2, &slots);
+    KUNIT_EXPECT_EQ(test, slots, 4ULL);
+    KUNIT_EXPECT_EQ(test, next, 4 * ms);
+
+    /* exactly on a deadline: that one has passed too */
+    set_timebase_frequency(&tb, 1000, NSEC_PER_SEC);
+    next = slot_sched_catch_up(&tb, 2 * ms, &slots);
+    KUNIT_EXPECT_EQ(test, slots, 3ULL);
+    KUNIT_EXPECT_EQ(test, next, 3 * ms);
+}
+
+static void edge_sched_advance_test(struct kunit *test){
+    struct gpio_line_state *gls = test_gls(test, 1, 1);
+    const u64 ms = NSEC_PER_MSEC;
+
+    set_timebase_frequency(&gls->tb, 1000, NSEC_PER_SEC);
+
+    /* on time: HIGH -> LOW, held for off_cycles */
+    KUNIT_EXPECT_EQ(test, edge_sched_advance(gls, 0), ms);
+    KUNIT_EXPECT_EQ(test, gls->pin_logic_level, LOGIC_LOW);
+    KUNIT_EXPECT_EQ(test, gls->overruns, 0UL);
+    KUNIT_EXPECT_EQ(test, gls->pulses, 1);
+
+    /* LOW -> HIGH but 10.5 ms late: the transitions at 1..10 ms are missed,
+     * the one at 10 ms leaving the line LOW again */
+    gls->pin_logic_level = LOGIC_HIGH;
+    gls->pulses = 0;
+    KUNIT_EXPECT_EQ(test, edge_sched_advance(gls, 10 * ms + ms / 2), 11 * ms);
+    KUNIT_EXPECT_EQ(test, gls->pin_logic_level, LOGIC_LOW);
+    KUNIT_EXPECT_EQ(test, gls->overruns, 10UL);
+    KUNIT_EXPECT_EQ(test, gls->pulses, 6);
+}
+
+static void test_done_work_func(struct work_struct *work){}
+
+/* a stall skips no more periods than 'count' leaves; in particular not the
+ * one a line that is HIGH after the skip completes by going LOW */
+static void sched_advance_count_test(struct kunit *test){
+    struct gpio_line_state *gls = test_gls(test, 1, 1);
+    const u64 ms = NSEC_PER_MSEC;
+
+    INIT_WORK(&gls->done_work, test_done_work_func);
+    set_timebase_frequency(&gls->tb, 1000, NSEC_PER_SEC);
+
+    /* LOW -> HIGH 100 ms late, 2 pulses to go */
+    gls->pin_logic_level = LOGIC_LOW;
+    gls->count = 5;
+    gls->pulses = 3;
+    KUNIT_EXPECT_EQ(test, edge_sched_advance(gls, 100 * ms), 0ULL);
+    KUNIT_EXPECT_EQ(test, gls->pulses, 5);
+    KUNIT_EXPECT_EQ(test, gls->pin_logic_level, LOGIC_LOW);
+    KUNIT_EXPECT_EQ(test, READ_ONCE(gls->done), 1);
+    flush_work(&gls->done_work);
+
+    /* slot-driven, HIGH, 100 slots at once */
+    gls->pin_logic_level = LOGIC_HIGH;
+    gls->counter = 0;
+    gls->pulses = 3;
+    gls->done = 0;
+    slot_sched_advance(gls, 100);
+    KUNIT_EXPECT_EQ(test, gls->pulses, 5);
+    KUNIT_EXPECT_EQ(test, READ_ONCE(gls->done), 1);
+    flush_work(&gls->done_work);
+
+    /* count lowered below the pulses generated: nothing to skip */
+    gls->pin_logic_level = LOGIC_HIGH;
+    gls->counter = 0;
+    gls->count = 2;
+    gls->pulses = 4;
+    gls->done = 0;
+    slot_sched_advance(gls, 100);
+    KUNIT_EXPECT_EQ(test, gls->pulses, 5);
+    KUNIT_EXPECT_EQ(test, READ_ONCE(gls->done), 1);
+    flush_work(&gls->done_work);
+}
+
+/* constant levels need no timer */
+static void edge_sched_constant_test(struct kunit *test){
+    struct gpio_line_state *gls = test_gls(test, 0, 3);
+
+    set_timebase_frequency(&gls->tb, 1000, NSEC_PER_SEC);
+    KUNIT_EXPECT_EQ(test, edge_sched_advance(gls, 0), 0ULL);
+    KUNIT_EXPECT_EQ(test, gls->pin_logic_level, LOGIC_LOW);
+
+    gls->on_cycles = 3;
+    gls->off_cycles = 0;
+    KUNIT_EXPECT_EQ(test, edge_sched_step(gls), 0);
+    KUNIT_EXPECT_EQ(test, gls->pin_logic_level, LOGIC_HIGH);
+}
+
+/* ==== slot-driven phase ==== */
+
+/* a line started 'phase' slots behind plays what one without does, that
+ * many slots later */
+static void slot_sched_phase_test(struct kunit *test){
+    struct gpio_line_state *a = test_gls(test, 1, 3), *b = test_gls(test, 1, 3);
+    int level[32];
+    unsigned int phase, n;
+
+    for (n = 0; n < ARRAY_SIZE(level); n++){
+        slot_sched_step(a);
+        level[n] = a->pin_logic_level;
+    }
+
+    for (phase = 1; phase < 8; phase++){
+        b->counter = 0;
+        b->pin_logic_level = LOGIC_HIGH;
+        b->phase = phase;
+        slot_sched_phase(b);
+
+        for (n = 0; n < ARRAY_SIZE(level); n++){
+            slot_sched_step(b);
+            if (n >= phase)
+                KUNIT_EXPECT_EQ_MSG(test, b->pin_logic_level, level[n - phase],
+                        "phase %u, slot %u", phase, n);
+        }
+    }
+
+    /* a whole period: as if no phase at all */
+    b->counter = 0;
+    b->pin_logic_level = LOGIC_HIGH;
+    b->phase = 4;
+    slot_sched_phase(b);
+    KUNIT_EXPECT_EQ(test, b->counter, 0);
+    KUNIT_EXPECT_EQ(test, b->pin_logic_level, LOGIC_HIGH);
+}
+
+/* ==== PDM ==== */
+
+/* the run lengths are those of the accumulator advanced slot by slot */
+static void pdm_step_test(struct kunit *test){
+    static const u32 levels[] = { 1, 100, PDM_MAX / 3, PDM_MAX / 2, PDM_MAX - 1 };
+    struct gpio_line_state *gls = test_gls(test, 0, 0);
+    u32 b, c, acc;
+    unsigned int i;
+    int k, n, slot;
+
+    for (i = 0; i < ARRAY_SIZE(levels); i++){
+        b = levels[i];
+        c = PDM_MAX - b;
+        gls->brightness = b;
+        gls->pdm_acc = acc = 0;
+
+        for (slot = 0; slot < 3 * PDM_MAX; slot += k){
+            k = pdm_step(gls);
+            KUNIT_ASSERT_GT(test, k, 0);
+
+            /* HIGH for as long as the accumulator overflows, LOW otherwise */
+            for (n = 0; n < k; n++){
+                KUNIT_EXPECT_EQ(test, gls->pin_logic_level, acc >= c ? LOGIC_HIGH : LOGIC_LOW);
+                acc = acc >= c ? acc - c : acc + b;
+            }
+            KUNIT_EXPECT_EQ(test, gls->pdm_acc, acc);
+
+            /* and the run is over: the next slot is at the other level */
+            KUNIT_EXPECT_NE(test, gls->pin_logic_level, acc >= c ? LOGIC_HIGH : LOGIC_LOW);
+        }
+    }
+
+    gls->brightness = 0;
+    KUNIT_EXPECT_EQ(test, pdm_step(gls), 0);
+    KUNIT_EXPECT_EQ(test, gls->pin_logic_level, LOGIC_LOW);
+
+    gls->brightness = PDM_MAX;
+    KUNIT_EXPECT_EQ(test, pdm_step(gls), 0);
+    KUNIT_EXPECT_EQ(test, gls->pin_logic_level, LOGIC_HIGH);
+}
+
+static void pdm_skip_test(struct kunit *test){
+    struct gpio_line_state *gls = test_gls(test, 0, 0), *ref = test_gls(test, 0, 0);
+    u64 slots = 0;
+
+    gls->brightness = ref->brightness = PDM_MAX / 3;
+    while (slots < 12345) slots += pdm_step(ref);
+
+    pdm_skip(gls, slots);
+    KUNIT_EXPECT_EQ(test, gls->pdm_acc, ref->pdm_acc);
+}
+
+/* ==== ramps ==== */
+
+static void ramp_linear_test(struct kunit *test){
+    struct gpio_line_state *gls = test_gls(test, 2, 10);
+    struct line_ramp *r = &gls->ramp;
+
+    set_timebase_frequency(&gls->tb, 1000, NSEC_PER_SEC);
+    r->curve = RAMP_LINEAR;
+    r->freq0 = 1000;  r->freq1 = 2000;
+    r->on0 = 2;       r->on1 = 10;
+    r->off0 = 10;     r->off1 = 2;
+
+    line_ramp_apply(gls, 1 << 15);
+    KUNIT_EXPECT_EQ(test, gls->on_cycles, 6);
+    KUNIT_EXPECT_EQ(test, gls->off_cycles, 6);
+    KUNIT_EXPECT_EQ(test, gls->tb.freq, 1500U);
+
+    line_ramp_apply(gls, 1 << 16);
+    KUNIT_EXPECT_EQ(test, gls->on_cycles, 10);
+    KUNIT_EXPECT_EQ(test, gls->off_cycles, 2);
+    KUNIT_EXPECT_EQ(test, gls->tb.freq, 2000U);
+    KUNIT_EXPECT_EQ(test, gls->tb.pulse_period, (u32)(NSEC_PER_SEC / 2000));
+
+    /* never a constant level on the way, but one at the end if asked for */
+    r->on0 = 0;  r->on1 = 0;
+    line_ramp_apply(gls, 1 << 15);
+    KUNIT_EXPECT_EQ(test, gls->on_cycles, 1);
+    line_ramp_apply(gls, 1 << 16);
+    KUNIT_EXPECT_EQ(test, gls->on_cycles, 0);
+}
+
+/* the duty cycle follows a square law: slower at the dim end */
+static void ramp_gamma_test(struct kunit *test){
+    struct gpio_line_state *gls = test_gls(test, 100, 300);
+    struct line_ramp *r = &gls->ramp;
+
+    KUNIT_EXPECT_EQ(test, ramp_sqrt_duty(1, 3), 1U << 15);
+    KUNIT_EXPECT_EQ(test, ramp_sqrt_duty(0, 0), 0U);
+    KUNIT_EXPECT_EQ(test, ramp_lerp(-100, 100, 1 << 15), 0LL);
+
+    set_timebase_frequency(&gls->tb, 1000, NSEC_PER_SEC);
+    r->curve = RAMP_GAMMA;
+    r->freq0 = r->freq1 = 1000;
+    r->on0 = 100;  r->on1 = 300;
+    r->off0 = 300; r->off1 = 100;
+    r->duty0 = ramp_sqrt_duty(r->on0, r->off0);
+    r->duty1 = ramp_sqrt_duty(r->on1, r->off1);
+
+    line_ramp_apply(gls, 0);
+    KUNIT_EXPECT_EQ(test, gls->on_cycles, 100);
+    KUNIT_EXPECT_EQ(test, gls->off_cycles, 300);
+
+    line_ramp_apply(gls, 1 << 15);
+    KUNIT_EXPECT_EQ(test, gls->on_cycles, 186);
+    KUNIT_EXPECT_EQ(test, gls->off_cycles, 214);
+
+    line_ramp_apply(gls, 1 << 16);
+    KUNIT_EXPECT_EQ(test, gls->on_cycles, 300);
+    KUNIT_EXPECT_EQ(test, gls->off_cycles, 100);
+}
+
+/* ==== DMA rendering ==== */
+
+static void dma_put_bits_test(struct kunit *test){
+    u32 buf[3] = { 0, 0, ~0U };
+    u64 pos = 0;
+
+    dma_put_bits(buf, &pos, LOGIC_HIGH, 3);
+    dma_put_bits(buf, &pos, LOGIC_LOW, 30);
+    dma_put_bits(buf, &pos, LOGIC_HIGH, 5);
+    KUNIT_EXPECT_EQ(test, pos, 38ULL);
+    KUNIT_EXPECT_EQ(test, buf[0], 0xe0000000U);
+    KUNIT_EXPECT_EQ(test, buf[1], 0x7c000000U);
+
+    /* LOW clears what was there */
+    dma_put_bits(buf, &pos, LOGIC_LOW, 64 - pos);
+    dma_put_bits(buf, &pos, LOGIC_LOW, 4);
+    KUNIT_EXPECT_EQ(test, buf[2], 0x0fffffffU);
+}
+
+static void line_dma_render_test(struct kunit *test){
+    struct gpio_line_state *gls = test_gls(test, 1, 2);
+    bool cyclic;
+
+    gls->dma = kunit_kzalloc(test, sizeof(*gls->dma), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, gls->dma);
+    gls->dma->buf = kunit_kzalloc(test, DMA_BUF_WORDS * sizeof(u32), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, gls->dma->buf);
+    gls->mode = MODE_PULSE;
+
+    /* a period of 3 bits, repeated 32 times to make up whole words */
+    gls->dma->stretch = 1;
+    KUNIT_EXPECT_EQ(test, line_dma_render(gls, &cyclic), 3);
+    KUNIT_EXPECT_TRUE(test, cyclic);
+    KUNIT_EXPECT_EQ(test, gls->dma->buf[0], 0x92492492U);
+    KUNIT_EXPECT_EQ(test, gls->dma->buf[1], 0x49249249U);
+    KUNIT_EXPECT_EQ(test, gls->dma->buf[2], 0x24924924U);
+
+    /* each slot over 2 bits: a period of 6, 16 times */
+    gls->dma->stretch = 2;
+    KUNIT_EXPECT_EQ(test, line_dma_render(gls, &cyclic), 3);
+    KUNIT_EXPECT_EQ(test, gls->dma->buf[0], 0xc30c30c3U);
+    KUNIT_EXPECT_EQ(test, gls->dma->buf[1], 0x0c30c30cU);
+    KUNIT_EXPECT_EQ(test, gls->dma->buf[2], 0x30c30c30U);
+
+    gls->on_cycles = 0;
+    KUNIT_EXPECT_EQ(test, line_dma_render(gls, &cyclic), 1);
+    KUNIT_EXPECT_EQ(test, gls->dma->buf[0], 0U);
+
+    /* too long a period to fit the buffer */
+    gls->on_cycles = DMA_BUF_WORDS * 32;
+    KUNIT_EXPECT_EQ(test, line_dma_render(gls, &cyclic), -E2BIG);
+
+    gls->on_cycles = 1;
+    gls->count = 10;
+    KUNIT_EXPECT_EQ(test, line_dma_render(gls, &cyclic), -EOPNOTSUPP);
+}
+
+/* ==== io_worker ==== */
+
+static struct gpio_line_state *io_written[4];
+static unsigned int io_nwritten;
+
+/* stands in for io_work_func(), recording which lines were written rather
+ * than writing them, since the test lines have no gpio descriptor */
+static void test_io_work_func(struct kthread_work *work){
+    struct llist_node *pending = llist_del_all(&io_pending);
+    struct gpio_line_state *gls, *next;
+
+    llist_for_each_entry_safe(gls, next, pending, io_node){
+        atomic_set(&gls->io_queued, 0);
+        smp_mb__after_atomic();
+        if (io_nwritten < ARRAY_SIZE(io_written)) io_written[io_nwritten++] = gls;
+    }
+}
+
+static void test_group_add(struct line_group *grp, struct gpio_line_state *gls){
+    gls->timer.backend = BACKEND_HRTIMER;
+    hrtimer_init(&gls->timer.hr, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    list_add_tail(&gls->group_node, &grp->members);
+    grp->descs[grp->nmembers++] = NULL;
+    gls->group = grp;
+}
+
+/*
+ * A non-sleeping line in a group with a sleeping one is written by io_worker
+ * too; once stopped, it has been written and is off io_pending. So is the
+ * sleeping one, whose leaving destroys the group. NOTE: the group is set up
+ * by hand, its timer never started; the suite runs before any line is
+ * probed, so io_worker is the test's alone (see initialize()). */
+static void line_group_deferred_test(struct kunit *test){
+    struct gpio_line_state *slow = test_gls(test, 1, 1), *fast = test_gls(test, 1, 1);
+    struct line_group *grp = kzalloc(sizeof(*grp), GFP_KERNEL);
+    unsigned int i;
+
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, grp);
+    INIT_LIST_HEAD(&grp->list);
+    INIT_LIST_HEAD(&grp->members);
+    raw_spin_lock_init(&grp->lock);
+    grp->timer.backend = BACKEND_HRTIMER;
+    hrtimer_init(&grp->timer.hr, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    grp->capacity = 2;
+    grp->descs = kcalloc(grp->capacity, sizeof(*grp->descs), GFP_KERNEL);
+    grp->values = bitmap_zalloc(grp->capacity, GFP_KERNEL);
+    if (!grp->descs || !grp->values){
+        line_group_destroy(grp);
+        KUNIT_ASSERT_FAILURE(test, "out of memory");
+    }
+
+    slow->io.kind = IO_WORKER;
+    fast->io.kind = IO_GPIOD;
+    test_group_add(grp, slow);
+    test_group_add(grp, fast);
+    line_group_update_io(grp);
+    KUNIT_EXPECT_TRUE(test, grp->deferred);
+
+    kthread_flush_work(&io_work);
+    kthread_init_work(&io_work, test_io_work_func);
+    io_nwritten = 0;
+
+    line_group_tick(grp, 1, 0, 0, 0);
+    stop_pulse_train(fast);
+    KUNIT_EXPECT_PTR_EQ(test, fast->group, (struct line_group *)NULL);
+    KUNIT_EXPECT_EQ(test, atomic_read(&fast->io_queued), 0);
+    for (i = 0; i < io_nwritten && io_written[i] != fast; i++);
+    KUNIT_EXPECT_LT(test, i, io_nwritten);
+
+    line_group_tick(grp, 1, 0, 0, 0);
+    stop_pulse_train(slow);
+    KUNIT_EXPECT_EQ(test, atomic_read(&slow->io_queued), 0);
+    KUNIT_EXPECT_EQ(test, io_nwritten, 3U);
+
+    kthread_init_work(&io_work, io_work_func);
+}
+
+static struct kunit_case gpioman_timing_cases[] = {
+    KUNIT_CASE(timebase_average_test),
+    KUNIT_CASE(timebase_split_test),
+    KUNIT_CASE(interval_to_slots_test),
+    KUNIT_CASE(slot_sched_catch_up_test),
+    KUNIT_CASE(edge_sched_advance_test),
+    KUNIT_CASE(sched_advance_count_test),
+    KUNIT_CASE(edge_sched_constant_test),
+    KUNIT_CASE(slot_sched_phase_test),
+    KUNIT_CASE(pdm_step_test),
+    KUNIT_CASE(pdm_skip_test),
+    KUNIT_CASE(ramp_linear_test),
+    KUNIT_CASE(ramp_gamma_test),
+    KUNIT_CASE(dma_put_bits_test),
+    KUNIT_CASE(line_dma_render_test),
+    KUNIT_CASE(line_group_deferred_test),
+    {}
+};
+
+static struct kunit_suite gpioman_timing_suite = {
+    .name = "gpioman-timing",
+    .test_cases = gpioman_timing_cases,
+};
+
+/* NULL-terminated; see initialize() */
+static struct kunit_suite *gpioman_kunit_suites[] = { &gpioman_timing_suite, NULL };
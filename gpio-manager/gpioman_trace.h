@@ -0,0 +1,97 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Tracepoints for the gpio manager. These replace logging from the timer
+ * callbacks, which distorts the very timing being looked at.
+ *
+ *   # echo 1 > /sys/kernel/tracing/events/gpioman/enable
+ *   # cat /sys/kernel/tracing/trace_pipe
+ *
+ * or with trace-cmd: trace-cmd record -e gpioman
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM gpioman
+
+#if !defined(_GPIOMAN_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _GPIOMAN_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* a line was driven to a new level */
+TRACE_EVENT(gpioman_edge,
+
+	TP_PROTO(const char *devname, int level),
+
+	TP_ARGS(devname, level),
+
+	TP_STRUCT__entry(
+		__string(devname, devname)
+		__field(int, level)
+	),
+
+	TP_fast_assign(
+		__assign_str(devname, devname);
+		__entry->level = level;
+	),
+
+	TP_printk("%s level=%d", __get_str(devname), __entry->level)
+);
+
+/*
+ * A timer callback ran. 'late_ns' is how far past its expiry it ran;
+ * 'slots' is the number of time slots (edge-driven: level transitions)
+ * the state machine was advanced by; 'nlines' is the number of lines
+ * driven by the timer (1 for edge-driven lines). */
+TRACE_EVENT(gpioman_timer_fire,
+
+	TP_PROTO(u32 freq, u64 late_ns, u64 slots, unsigned int nlines),
+
+	TP_ARGS(freq, late_ns, slots, nlines),
+
+	TP_STRUCT__entry(
+		__field(u32, freq)
+		__field(u64, late_ns)
+		__field(u64, slots)
+		__field(unsigned int, nlines)
+	),
+
+	TP_fast_assign(
+		__entry->freq = freq;
+		__entry->late_ns = late_ns;
+		__entry->slots = slots;
+		__entry->nlines = nlines;
+	),
+
+	TP_printk("freq=%u late_ns=%llu slots=%llu nlines=%u",
+		__entry->freq, __entry->late_ns, __entry->slots, __entry->nlines)
+);
+
+/* a sysfs attribute of a line was written */
+TRACE_EVENT(gpioman_config,
+
+	TP_PROTO(const char *devname, const char *attr, int value),
+
+	TP_ARGS(devname, attr, value),
+
+	TP_STRUCT__entry(
+		__string(devname, devname)
+		__string(attr, attr)
+		__field(int, value)
+	),
+
+	TP_fast_assign(
+		__assign_str(devname, devname);
+		__assign_str(attr, attr);
+		__entry->value = value;
+	),
+
+	TP_printk("%s %s=%d", __get_str(devname), __get_str(attr), __entry->value)
+);
+
+#endif /* _GPIOMAN_TRACE_H */
+
+/* this part must be outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE gpioman_trace
+#include <trace/define_trace.h>
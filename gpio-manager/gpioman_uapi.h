@@ -0,0 +1,123 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/*
+ * Userspace interface of the gpio manager character devices,
+ * /dev/gpioman/<devname>, one per line, and /dev/gpioman-control.
+ *
+ * Streaming (mode=3): the device is mmap()ed to get at a single-producer,
+ * single-consumer ring of entries, each a (level, duration) pair in the same
+ * format as the 'pattern' sysfs attribute. Userspace produces entries at
+ * 'head', the timer callback consumes them at 'tail'; both indices are
+ * free-running and taken modulo 'size'. No syscall is needed as long as the
+ * ring does not run empty. When it does, the line goes LOW, the callback
+ * stops and GPIOMAN_RING_STOPPED is set in 'flags'; once more entries have
+ * been produced, GPIOMAN_IOC_KICK starts the stream off again.
+ *
+ * poll() reports the device writable when at least half of the ring is free
+ * (or the stream has stopped); the callback wakes pollers up as it crosses
+ * that mark, i.e. once per half ring rather than per entry.
+ *
+ * Parallel ports (device nodes with more than one line) take each entry as a
+ * whole word instead, bit i driving the i-th line, put out for one time slot.
+ *
+ * Input lines (vcstech,input in the DT) have no ring to mmap(). Their edges
+ * are read() instead, as an array of struct gpioman_event, as many as fit in
+ * the buffer. poll() reports the device readable, and a blocking read()
+ * returns, once 'capture_batch' events (see sysfs) are pending.
+ *
+ * /dev/gpioman-control configures any number of lines in one go with
+ * GPIOMAN_IOC_CONFIG, taking an array of struct gpioman_line_config. Each
+ * entry has the effect of a write to the 'phase' and 'config' sysfs
+ * attributes of the line with the given 'id' (see sysfs), or only to
+ * 'config' with a phase of GPIOMAN_PHASE_KEEP. The array is checked as a
+ * whole first: if any entry is invalid, or an id is listed twice, none is
+ * applied. With
+ * GPIOMAN_CONFIG_SYNC, the lines are all restarted against a common start
+ * time instead, as by the 'start' driver attribute.
+ *
+ * Line ids are handed out as the lines are probed. The driver probes
+ * asynchronously (PROBE_PREFER_ASYNCHRONOUS), so that is in no fixed order
+ * and the id of a line can differ from one boot to the next: never hard-code
+ * ids, look them up by name with GPIOMAN_IOC_LOOKUP instead.
+ */
+#ifndef _GPIOMAN_UAPI_H
+#define _GPIOMAN_UAPI_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define GPIOMAN_RING_ENTRIES 4096  /* power of 2 */
+
+/* level in bit 31, duration in time slots (1/freq) in bits 30..0 */
+#define GPIOMAN_ENTRY(level, slots) \
+    ((((__u32)!!(level)) << 31) | ((__u32)(slots) & 0x7fffffff))
+
+/* flags */
+#define GPIOMAN_RING_STOPPED (1U << 0)  /* ran empty; see GPIOMAN_IOC_KICK */
+
+/*
+ * Layout of the mapping. head and tail are on different cache lines since
+ * they are written by different CPUs. NOTE: the kernel only ever reads head
+ * and entries[], and keeps its own copy of tail; writes to the other fields
+ * have no effect. */
+struct gpioman_ring {
+    __u32 head;        /* written by userspace: next entry to produce */
+    __u32 __pad0[15];
+    __u32 tail;        /* written by the kernel: next entry to consume */
+    __u32 flags;       /* written by the kernel */
+    __u32 size;        /* number of entries: GPIOMAN_RING_ENTRIES */
+    __u32 __pad1[13];
+    __u32 entries[GPIOMAN_RING_ENTRIES];
+};
+
+/* an edge on an input line */
+struct gpioman_event {
+    __u64 timestamp_ns;  /* CLOCK_MONOTONIC, taken in the interrupt handler */
+    __u32 level;         /* after the edge */
+    __u32 __pad;
+};
+
+/* settings of a line; as per the sysfs attributes of the same names */
+struct gpioman_line_config {
+    __u32 id;
+    __u32 freq;
+    __u32 on_cycles;
+    __u32 off_cycles;
+    __u32 status;
+    __u32 phase;  /* or GPIOMAN_PHASE_KEEP */
+};
+
+/* phase: leave that of the line as it is */
+#define GPIOMAN_PHASE_KEEP (~0U)
+
+#define GPIOMAN_CONFIG_MAX 1024  /* entries per GPIOMAN_IOC_CONFIG */
+
+/* flags */
+#define GPIOMAN_CONFIG_SYNC (1U << 0)  /* restart all against a common start time */
+
+struct gpioman_config {
+    __u64 entries;  /* pointer to an array of struct gpioman_line_config */
+    __u32 count;    /* number of entries; at most GPIOMAN_CONFIG_MAX */
+    __u32 flags;
+};
+
+#define GPIOMAN_NAME_MAX 64  /* including the NUL */
+
+/* a line by name: its DT node name, or its entry in vcstech,line-names */
+struct gpioman_line_lookup {
+    char name[GPIOMAN_NAME_MAX];  /* NUL-terminated */
+    __u32 id;                     /* written by the kernel */
+    __u32 __pad;
+};
+
+#define GPIOMAN_IOC_MAGIC 0xb7
+
+/* restart a stream that ran empty; no-op otherwise */
+#define GPIOMAN_IOC_KICK _IO(GPIOMAN_IOC_MAGIC, 0)
+
+/* /dev/gpioman-control only: configure lines in bulk */
+#define GPIOMAN_IOC_CONFIG _IOW(GPIOMAN_IOC_MAGIC, 1, struct gpioman_config)
+
+/* /dev/gpioman-control only: the id of a line, for GPIOMAN_IOC_CONFIG */
+#define GPIOMAN_IOC_LOOKUP _IOWR(GPIOMAN_IOC_MAGIC, 2, struct gpioman_line_lookup)
+
+#endif /* _GPIOMAN_UAPI_H */